@@ -13,6 +13,11 @@
 
 #include <glad/glad.h>
 
+#if defined(_M_X64) || defined(__SSE2__)
+#define ATTO_SIMD_SSE 1
+#include <immintrin.h>
+#endif
+
 #include <al/alc.h>
 #include <al/al.h>
 
@@ -38,6 +43,8 @@ namespace atto {
     const static DebugFunctionKey debugDrawBoundsAndColliders(KEY_CODE_F1);
     const static DebugFunctionKey debugDrawUnitRanges(KEY_CODE_F2);
     const static DebugFunctionKey debugDrawTileLocation(KEY_CODE_F3);
+    const static DebugFunctionKey debugDrawRenderingStats(KEY_CODE_F4);
+    const static DebugFunctionKey debugUseSpriteInstancing(KEY_CODE_F6);
 
     static void FindAllFiles(const char* path, const char* extension, List<LargeString>& files) {
         for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
@@ -50,6 +57,8 @@ namespace atto {
     bool LeEngine::Initialize(AppState* appState) {
         app = appState;
 
+        RenderStateInvalidate();
+
         basePathAssets = LargeString::FromLiteral("assets/");
         basePathSprites = LargeString::FromLiteral("assets/sprites/");
         basePathSounds = LargeString::FromLiteral("assets/sounds/");
@@ -63,12 +72,16 @@ namespace atto {
 
         InitializeLuaBindings();
 
+        InitializeFrameUniforms();
+        InitializeStreamingVertexBuffer();
         InitializeShapeRendering();
         InitializeUIRendering(app);
         InitializeSpriteRendering();
         InitializeTextRendering();
         InitializeDebugRendering();
 
+        SpriteAtlasCook();
+
         const char* mapData =
             "1111111111111111"  //1
             "1000000000000001"  //2
@@ -109,13 +122,15 @@ namespace atto {
         MapCreate(&demoMap, mapData, 16, 16);
         currentMap = &demoMap;
 
+        updateTick = 0;
+        unitTargetAcquireInterval = 4;
+        pathRequestBudgetMicroseconds = 1000.0;
+
         cameraPos = MapTilePosToWorldPos(currentMap, glm::vec2(4, 4));
 
         {
             Entity entity = {};
             //entity.pos = glm::vec2(mainSurfaceWidth/ 2, mainSurfaceHeight/2);
-            //entity.unit.active = true;
-            entity.unit.isSelected = true;
             entity.sprite1.active = true;
             entity.sprite1.sprite = GetSpriteAsset(AssetId::Create("tile_test"));
             //entities.Add(entity);
@@ -127,24 +142,22 @@ namespace atto {
 
                 for (int i = 0; i < 1; i++) {
                     //entity.pos = glm::vec2(mainSurfaceWidth / 2, mainSurfaceHeight / 2);
-                    Entity* entity = MapCreateEntity();
-                    entity->pos.x = x;
-                    entity->pos.y = y;
+                    UnitStreams& units = currentMap->units;
+                    const i32 unitIndex = MapGetEntity(MapCreateEntity());
+                    units.pos[unitIndex].x = x;
+                    units.pos[unitIndex].y = y;
 
                     x -= 12;
                     y -= 6;
 
-                    entity->localBoundingBox.min = glm::vec2(-4, 0);
-                    entity->localBoundingBox.max = glm::vec2(3, 14);
-                    entity->unit.localColldier.rad = 4;
-                    entity->unit.health = 100;
-                    entity->unit.active = true;
-                    entity->unit.isSelected = false;
-                    entity->sprite1.active = true;
-                    entity->sprite1.sprite = GetSpriteAsset(AssetId::Create("unit_basic_man"));
-
-                    entity->sprite2.active = true;
-                    entity->sprite2.sprite = GetSpriteAsset(AssetId::Create("unit_basic_man_selection"));
+                    units.localBoundingBox[unitIndex].min = glm::vec2(-4, 0);
+                    units.localBoundingBox[unitIndex].max = glm::vec2(3, 14);
+                    units.colliderRad[unitIndex] = 4;
+                    units.health[unitIndex] = 100;
+                    units.active[unitIndex] = true;
+                    units.isSelected[unitIndex] = false;
+                    units.sprite[unitIndex] = GetSpriteAsset(AssetId::Create("unit_basic_man"));
+                    units.selectionSprite[unitIndex] = GetSpriteAsset(AssetId::Create("unit_basic_man_selection"));
                 }
             }
         }
@@ -154,23 +167,23 @@ namespace atto {
                 f32 y = -200 + -6.0f * j;
                 for (int i = 0; i < 5; i++) {
                     //entity.pos = glm::vec2(mainSurfaceWidth / 2, mainSurfaceHeight / 2);
-                    Entity* entity = MapCreateEntity();
-                    entity->pos.x = x;
-                    entity->pos.y = y;
+                    UnitStreams& units = currentMap->units;
+                    const i32 unitIndex = MapGetEntity(MapCreateEntity());
+                    units.pos[unitIndex].x = x;
+                    units.pos[unitIndex].y = y;
 
                     x -= 12;
                     y -= 6;
 
-                    entity->localBoundingBox.min = glm::vec2(-4, 0);
-                    entity->localBoundingBox.max = glm::vec2(3, 14);
+                    units.localBoundingBox[unitIndex].min = glm::vec2(-4, 0);
+                    units.localBoundingBox[unitIndex].max = glm::vec2(3, 14);
 
-                    entity->unit.active = true;
-                    entity->unit.isSelected = false;
-                    entity->unit.teamNumber = true;
-                    entity->unit.localColldier.rad = 4;
-                    entity->unit.health = 100;
-                    entity->sprite1.active = true;
-                    entity->sprite1.sprite = GetSpriteAsset(AssetId::Create("unit_basic_man_enemy"));
+                    units.active[unitIndex] = true;
+                    units.isSelected[unitIndex] = false;
+                    units.teamNumber[unitIndex] = 1;
+                    units.colliderRad[unitIndex] = 4;
+                    units.health[unitIndex] = 100;
+                    units.sprite[unitIndex] = GetSpriteAsset(AssetId::Create("unit_basic_man_enemy"));
                 }
             }
         }
@@ -188,6 +201,10 @@ namespace atto {
                 DebugFunctionKey::keys[i]->value = !DebugFunctionKey::keys[i]->value;
             }
         }
+
+        if (IsKeyJustDown(app->input, KEY_CODE_F5)) {
+            DEBUGRunBenchmarks();
+        }
 #endif
 
         DrawShapeClearCommands();
@@ -257,7 +274,6 @@ namespace atto {
         }
 
         const glm::vec2 mousePosWorldSpace = GetMousePosWorldSpace();
-        const glm::vec2 mousePosTileSpace = MapWorldPosToTilePos(currentMap, mousePosWorldSpace);
 
         const f32 roomWidth = (f32)mainSurfaceWidth;
         const f32 roomHeight = (f32)mainSurfaceHeight;
@@ -265,260 +281,272 @@ namespace atto {
         const f32 halfRoomWidth = roomWidth / 2.0f;
         const f32 halfRoomHeight = roomHeight / 2.0f;
 
-        const i32 entityCapcity = currentMap->unitEntities.GetCapcity();
-        for (i32 unitIndex = 0; unitIndex < entityCapcity; unitIndex++) {
-            Entity& entity = currentMap->unitEntities[unitIndex];
+        const f32 moveDistance = 25.0f * app->deltaTime;
+        const f32 firingRange = 25;
+        const f32 fieldOfView = 50;
+
+        MapStepSpriteAnimations(currentMap, app->deltaTime);
+        MapRebuildUnitGrid(currentMap);
+        MapRebuildTeamGrids(currentMap, fieldOfView);
+        MapServicePathRequests(currentMap, pathRequestBudgetMicroseconds);
 
-            if (entity.id == ENTITY_ID_INVALID) {
+        UnitStreams& units = currentMap->units;
+
+        // Orders for a single unit get their own path search, bigger groups share a flow field
+        i32 orderedUnitCount = 0;
+        if (IsMouseJustDown(app->input, MOUSE_BUTTON_RIGHT)) {
+            for (i32 aliveIndex = 0; aliveIndex < units.aliveSlots.GetCount(); aliveIndex++) {
+                const i32 unitIndex = units.aliveSlots[aliveIndex];
+                if (units.active[unitIndex] && units.isSelected[unitIndex] && units.teamNumber[unitIndex] == 0) {
+                    orderedUnitCount++;
+                }
+            }
+        }
+
+        for (i32 aliveIndex = 0; aliveIndex < units.aliveSlots.GetCount(); aliveIndex++) {
+            const i32 unitIndex = units.aliveSlots[aliveIndex];
+            if (!units.active[unitIndex]) {
                 continue;
             }
 
-            if (entity.unit.active) {
-                const f32 moveDistance = 25.0f * app->deltaTime;
-                const f32 firingRange = 25;
-                const f32 fieldOfView = 50;
-                const f32 fieldOfViewSqrd = fieldOfView * fieldOfView;
-
-                if (entity.unit.teamNumber == 0) {
-                    // Player updates
-                    if (selectionBoxNow) {
-                        entity.unit.isSelected = false;
-                        const glm::vec2 entityPos = entity.pos;
-                        const BoxBounds entityBounds = EntityGetBoundingBox(entity);
-                        if (selectionBounds.Intersects(entityBounds)) {
-                            entity.unit.isSelected = true;
-                        }
+            UnitTarget& target = units.target[unitIndex];
+
+            if (units.teamNumber[unitIndex] == 0) {
+                // Player updates
+                if (selectionBoxNow) {
+                    units.isSelected[unitIndex] = false;
+                    const BoxBounds unitBounds = UnitGetBoundingBox(currentMap, unitIndex);
+                    if (selectionBounds.Intersects(unitBounds)) {
+                        units.isSelected[unitIndex] = true;
                     }
+                }
 
-                    if (selectionSingleNow) {
-                        entity.unit.isSelected = false;
-                        const BoxBounds entityBounds = EntityGetBoundingBox(entity);
-                        if (entityBounds.Contains(mousePosWorldSpace)) {
-                            entity.unit.isSelected = true;
-                        }
+                if (selectionSingleNow) {
+                    units.isSelected[unitIndex] = false;
+                    const BoxBounds unitBounds = UnitGetBoundingBox(currentMap, unitIndex);
+                    if (unitBounds.Contains(mousePosWorldSpace)) {
+                        units.isSelected[unitIndex] = true;
                     }
+                }
 
-                    if (IsMouseJustDown(app->input, MOUSE_BUTTON_RIGHT) && entity.unit.isSelected) {
-                        bool isBasicMoveCommand = true;
-                        for (i32 otherUnitIndex = 0; otherUnitIndex < entityCapcity; otherUnitIndex++) {
-                            if (otherUnitIndex == unitIndex) {
-                                continue;
-                            }
+                if (IsMouseJustDown(app->input, MOUSE_BUTTON_RIGHT) && units.isSelected[unitIndex]) {
+                    MapReleaseUnitPath(currentMap, unitIndex);
 
-                            Entity& otherUnit = currentMap->unitEntities[otherUnitIndex];
-                            if (otherUnit.unit.teamNumber) {
-                                const BoxBounds otherUnitBounds = EntityGetBoundingBox(otherUnit);
-                                if (otherUnitBounds.Contains(mousePosWorldSpace)) {
-                                    entity.unit.target.type = UNIT_TARGET_TYPE_UNIT;
-                                    entity.unit.target.unitId = otherUnit.id;
-                                    isBasicMoveCommand = false;
-                                    break;
-                                }
+                    bool isBasicMoveCommand = true;
+                    for (i32 otherAliveIndex = 0; otherAliveIndex < units.aliveSlots.GetCount(); otherAliveIndex++) {
+                        const i32 otherUnitIndex = units.aliveSlots[otherAliveIndex];
+                        if (otherUnitIndex == unitIndex || !units.active[otherUnitIndex]) {
+                            continue;
+                        }
+
+                        if (units.teamNumber[otherUnitIndex]) {
+                            const BoxBounds otherUnitBounds = UnitGetBoundingBox(currentMap, otherUnitIndex);
+                            if (otherUnitBounds.Contains(mousePosWorldSpace)) {
+                                target.type = UNIT_TARGET_TYPE_UNIT;
+                                target.unitId = units.id[otherUnitIndex];
+                                isBasicMoveCommand = false;
+                                break;
                             }
                         }
+                    }
 
-                        if (isBasicMoveCommand) {
-                            entity.unit.target.type = UNIT_TARGET_TYPE_GROUND_POS;
-                            entity.unit.target.groundPos = mousePosWorldSpace;
+                    if (isBasicMoveCommand) {
+                        target.type = UNIT_TARGET_TYPE_GROUND_POS;
+                        target.groundPos = mousePosWorldSpace;
 
-                            for (i32 i = 0; i < currentMap->blockerTileEntities.GetCapcity(); i++) {
-                                currentMap->blockerTileEntities[i].tile.parent = nullptr;
-                                currentMap->blockerTileEntities[i].tile.reached = false;
-                                currentMap->blockerTileEntities[i].tile.pathed = false;
-                            }
+                        // Group orders share the destination's flow field instead, it gets built on first use
+                        if (orderedUnitCount == 1) {
+                            MapRequestUnitPath(currentMap, unitIndex, mousePosWorldSpace);
+                        }
+                    }
+                }
+            }
+            else {
+                // Strat AI Updates
+            }
 
-                            static FixedQueue<MapTile*, Map::TILE_CAPCITY> frontier = {};
-                            frontier.Clear();
-
-                            glm::vec2 entityTilePos = MapWorldPosToTilePos(currentMap, entity.pos);
-                            MapTile* startingTile = MapGetTile(currentMap, entityTilePos);
-                            MapTile* endingTile = MapGetTile(currentMap, mousePosTileSpace);
-
-                            Assert(startingTile != nullptr, "Entity on invalid tile");
-                            if (endingTile != nullptr && startingTile != nullptr) {
-                                frontier.Enqueue(startingTile);
-
-                                bool pathFound = false;
-                                while (!frontier.IsEmpty()) {
-                                    MapTile* currentTile = frontier.Dequeue();
-                                    if (currentTile == endingTile) {
-                                        pathFound = true;
-                                        break;
-                                    }
-
-                                    FixedList<MapTile*, 8> neighbors = {};
-                                    MapGetTileNeighbors(currentMap, currentTile, neighbors);
-
-                                    const i32 neighborCount = neighbors.GetCount();
-                                    for (i32 neighborIndex = 0; neighborIndex < neighborCount; neighborIndex++) {
-                                        MapTile* neighbor = neighbors[neighborIndex];
-                                        if (!neighbor->reached && !neighbor->isBlocker) {
-                                            neighbor->reached = true;
-                                            neighbor->parent = currentTile;
-                                            frontier.Enqueue(neighbor);
-                                        }
-                                    }
-                                }
+            units.spriteFrameIndex[unitIndex] = 0;
 
-                                if (pathFound) {
-                                    MapTile* currentTile = endingTile->parent;
-                                    while (currentTile != startingTile) {
-                                        currentTile->pathed = true;
-                                        currentTile = currentTile->parent;
-                                    }
-                                }
-                            }
+            units.timeToNextFire[unitIndex] -= app->deltaTime;
+            units.timeFiring[unitIndex] -= app->deltaTime;
+
+            units.timeToNextFire[unitIndex] = glm::max(units.timeToNextFire[unitIndex], 0.0f);
+            units.timeFiring[unitIndex] = glm::max(units.timeFiring[unitIndex], 0.0f);
+
+            if (target.type == UNIT_TARGET_TYPE_GROUND_POS) {
+                const glm::vec2 unitTilePos = MapWorldPosToTilePos(currentMap, units.pos[unitIndex]);
+                const glm::vec2 targetTilePos = MapWorldPosToTilePos(currentMap, target.groundPos);
+
+                // Walk straight at the point while the path is being searched for
+                const bool isWaitingForPath = MapPollUnitPathRequest(currentMap, unitIndex);
 
+                // Follow the unit's path or the flow field until we reach the destination tile, then walk straight to the point
+                glm::vec2 flowDirection = glm::vec2(0.0f);
+                if (unitTilePos != targetTilePos && !isWaitingForPath) {
+                    if (units.pathIndex[unitIndex] != -1) {
+                        flowDirection = MapFollowUnitPath(currentMap, unitIndex);
+                    }
+
+                    if (flowDirection == glm::vec2(0.0f)) {
+                        if (const FlowField* flowField = MapGetFlowField(currentMap, (i32)targetTilePos.x, (i32)targetTilePos.y)) {
+                            flowDirection = MapSampleFlowField(currentMap, flowField, units.pos[unitIndex]);
                         }
                     }
                 }
-                else {
-                    // Strat AI Updates
-                }
 
-                entity.sprite1.currentFrameIndex = 0;
+                const glm::vec2 toTarget = target.groundPos - units.pos[unitIndex];
+                const f32 distanceToTarget = glm::length(toTarget);
+                const glm::vec2 direction = toTarget / distanceToTarget;
 
-                entity.unit.timeToNextFire -= app->deltaTime;
-                entity.unit.timeFiring -= app->deltaTime;
+                if (flowDirection != glm::vec2(0.0f)) {
+                    if (flowDirection.x > 0.0f) {
+                        units.spriteFrameIndex[unitIndex] = 0;
+                    }
+                    else {
+                        units.spriteFrameIndex[unitIndex] = 1;
+                    }
 
-                entity.unit.timeToNextFire = glm::max(entity.unit.timeToNextFire, 0.0f);
-                entity.unit.timeFiring = glm::max(entity.unit.timeFiring, 0.0f);
+                    units.pos[unitIndex] += flowDirection * moveDistance;
+                }
+                else if (!ApproxEqual(distanceToTarget, 0.0f)) {
+                    if (direction.x > 0.0f) {
+                        units.spriteFrameIndex[unitIndex] = 0;
+                    }
+                    else {
+                        units.spriteFrameIndex[unitIndex] = 1;
+                    }
 
-                if (entity.unit.target.type == UNIT_TARGET_TYPE_GROUND_POS) {
-                    const glm::vec2 toTarget = entity.unit.target.groundPos - entity.pos;
+                    if (moveDistance > distanceToTarget) {
+                        units.pos[unitIndex] = target.groundPos;
+                        target.type = UNIT_TARGET_TYPE_NONE;
+                        MapReleaseUnitPath(currentMap, unitIndex);
+                    }
+                    else {
+                        units.pos[unitIndex] += direction * moveDistance;
+                    }
+                }
+            }
+            else if (target.type == UNIT_TARGET_TYPE_UNIT) {
+                const i32 otherUnitIndex = MapGetEntity(target.unitId);
+                if (otherUnitIndex != -1) {
+                    const glm::vec2 otherUnitPos = units.pos[otherUnitIndex];
+                    const glm::vec2 toTarget = otherUnitPos - units.pos[unitIndex];
                     const f32 distanceToTarget = glm::length(toTarget);
                     const glm::vec2 direction = toTarget / distanceToTarget;
 
-
-                    if (!ApproxEqual(distanceToTarget, 0.0f)) {
-                        if (direction.x > 0.0f) {
-                            entity.sprite1.currentFrameIndex = 0;
-                        }
-                        else {
-                            entity.sprite1.currentFrameIndex = 1;
-                        }
-
-                        if (moveDistance > distanceToTarget) {
-                            entity.pos = entity.unit.target.groundPos;
-                            entity.unit.target.type = UNIT_TARGET_TYPE_NONE;
+                    if (distanceToTarget <= firingRange) {
+                        if (otherUnitPos.x > units.pos[unitIndex].x) {
+                            units.spriteFrameIndex[unitIndex] = 2;
                         }
                         else {
-                            entity.pos += direction * moveDistance;
+                            units.spriteFrameIndex[unitIndex] = 3;
                         }
-                    }
-                }
-                else if (entity.unit.target.type == UNIT_TARGET_TYPE_UNIT) {
-                    if (Entity* otherEntity = MapGetEntity(entity.unit.target.unitId)) {
-                        const glm::vec2 toTarget = otherEntity->pos - entity.pos;
-                        const f32 distanceToTarget = glm::length(toTarget);
-                        const glm::vec2 direction = toTarget / distanceToTarget;
-
-                        if (distanceToTarget <= firingRange) {
-                            if (otherEntity->pos.x > entity.pos.x) {
-                                entity.sprite1.currentFrameIndex = 2;
-                            }
-                            else {
-                                entity.sprite1.currentFrameIndex = 3;
-                            }
 
-                            if (entity.unit.timeToNextFire <= 0.0f) {
-                                entity.unit.timeToNextFire = 1.0f;
-                                AudioPlay(AudioAssetId::Create("assets/sounds/gun_pistol_shot_01"));
-                                entity.unit.timeFiring = 0.2f;
-
-                                if (otherEntity->unit.health > 0) {
-                                    otherEntity->unit.health -= 50;
-                                    if (otherEntity->unit.health <= 0) {
-                                        otherEntity->sprite1.active = false;
-                                        AudioPlay(AudioAssetId::Create("assets/sounds/basic_death_1"));
-                                        entity.unit.target.type = UNIT_TARGET_TYPE_NONE;
-                                        MapDestroyEntity(otherEntity);
-                                    }
+                        if (units.timeToNextFire[unitIndex] <= 0.0f) {
+                            units.timeToNextFire[unitIndex] = 1.0f;
+                            AudioPlay(AudioAssetId::Create("assets/sounds/gun_pistol_shot_01"));
+                            units.timeFiring[unitIndex] = 0.2f;
+
+                            if (units.health[otherUnitIndex] > 0) {
+                                units.health[otherUnitIndex] -= 50;
+                                if (units.health[otherUnitIndex] <= 0) {
+                                    AudioPlay(AudioAssetId::Create("assets/sounds/basic_death_1"));
+                                    target.type = UNIT_TARGET_TYPE_NONE;
+                                    MapDestroyEntity(units.id[otherUnitIndex]);
                                 }
                             }
+                        }
 
-                            if (entity.unit.timeFiring > 0.0) {
-                                if (otherEntity->pos.x > entity.pos.x) {
-                                    entity.sprite1.currentFrameIndex = 5;
-                                }
-                                else {
-                                    entity.sprite1.currentFrameIndex = 4;
-                                }
+                        if (units.timeFiring[unitIndex] > 0.0) {
+                            if (otherUnitPos.x > units.pos[unitIndex].x) {
+                                units.spriteFrameIndex[unitIndex] = 5;
+                            }
+                            else {
+                                units.spriteFrameIndex[unitIndex] = 4;
                             }
-                        }
-                        else {
-                            entity.pos += direction * moveDistance;
                         }
                     }
                     else {
-                        entity.unit.target.type = UNIT_TARGET_TYPE_NONE;
+                        units.pos[unitIndex] += direction * moveDistance;
                     }
                 }
-                else if (entity.unit.target.type == UNIT_TARGET_TYPE_NONE) {
-                    f32 unitDistance = 999999.0f;
-                    for (i32 otherUnitIndex = 0; otherUnitIndex < entityCapcity; otherUnitIndex++) {
-                        if (otherUnitIndex == unitIndex) {
-                            continue;
-                        }
-
-                        Entity& otherUnit = currentMap->unitEntities[otherUnitIndex];
-
-                        if (entity.unit.teamNumber != otherUnit.unit.teamNumber) {
-                            f32 d = glm::distance2(entity.pos, otherUnit.pos);
-                            if (d < fieldOfViewSqrd && d < unitDistance) {
-                                unitDistance = d;
-                                entity.unit.target.type = UNIT_TARGET_TYPE_UNIT;
-                                entity.unit.target.unitId = otherUnit.id;
-                            }
-                        }
+                else {
+                    target.type = UNIT_TARGET_TYPE_NONE;
+                }
+            }
+            else if (target.type == UNIT_TARGET_TYPE_NONE) {
+                // Staggered by slot so only a slice of the idle units searches each update. The interval is tunable,
+                // anything below 1 means every update.
+                if ((updateTick + (u32)unitIndex) % (u32)glm::max(unitTargetAcquireInterval, 1) == 0) {
+                    const i32 enemyUnitIndex = MapFindNearestEnemy(currentMap, unitIndex, fieldOfView);
+                    if (enemyUnitIndex != -1) {
+                        target.type = UNIT_TARGET_TYPE_UNIT;
+                        target.unitId = units.id[enemyUnitIndex];
                     }
                 }
+            }
 
-                for (i32 otherUnitIndex = 0; otherUnitIndex < entityCapcity; otherUnitIndex++) {
+            {
+                const Circle queryCollider = UnitGetCollider(currentMap, unitIndex);
+                const glm::vec2 queryReach = glm::vec2(queryCollider.rad + currentMap->unitGridMaxRadius + moveDistance);
+                currentMap->unitGrid.Query(queryCollider.pos - queryReach, queryCollider.pos + queryReach, [&](i32 otherUnitIndex) {
                     if (otherUnitIndex == unitIndex) {
-                        continue;
+                        return;
                     }
 
-                    Entity& otherUnit = currentMap->unitEntities[otherUnitIndex];
-
-                    if (otherUnit.unit.active) {
-                        const Circle currentUnitCollider = UnitGetCollider(entity);
-                        const Circle otherUnitCollider = UnitGetCollider(otherUnit);
+                    if (units.active[otherUnitIndex]) {
+                        const Circle currentUnitCollider = UnitGetCollider(currentMap, unitIndex);
+                        const Circle otherUnitCollider = UnitGetCollider(currentMap, otherUnitIndex);
 
                         Manifold manifold = {};
                         if (otherUnitCollider.Collision(currentUnitCollider, manifold)) {
-                            entity.pos += manifold.normal * manifold.penetration;
+                            units.pos[unitIndex] += manifold.normal * manifold.penetration;
                         }
                     }
-                }
-
-                const i32 blockerCapcity = currentMap->blockerTileEntities.GetCapcity();
-                for (i32 i = 0; i < blockerCapcity; i++) {
-                    Entity& blocker = currentMap->blockerTileEntities[i];
-                    if (blocker.tile.isBlocker) {
-                        const Circle currentUnitCollider = UnitGetCollider(entity);
-                        const PolygonCollider blockerCollider = BlockerGetCollider(blocker);
+                });
+            }
 
-                        Manifold manifold = {};
-                        if (CollisionTests::CirclePoly(currentUnitCollider, blockerCollider, manifold)) {
-                            entity.pos -= manifold.normal * manifold.penetration;
+            {
+                // Blockers are tiles, so only the tiles under the collider's bounds can touch it
+                const Circle queryCollider = UnitGetCollider(currentMap, unitIndex);
+                BoxBounds queryBounds = {};
+                queryBounds.CreateFromCenterSize(queryCollider.pos, glm::vec2(queryCollider.rad * 2.0f));
+
+                glm::ivec2 minTile = {};
+                glm::ivec2 maxTile = {};
+                if (MapWorldBoundsToTileRange(currentMap, queryBounds, minTile, maxTile)) {
+                    for (i32 tileY = minTile.y; tileY <= maxTile.y; tileY++) {
+                        for (i32 tileX = minTile.x; tileX <= maxTile.x; tileX++) {
+                            Entity& blocker = currentMap->blockerTileEntities[MapTilePosToIndex(currentMap, tileX, tileY)];
+                            if (blocker.tile.isBlocker) {
+                                const Circle currentUnitCollider = UnitGetCollider(currentMap, unitIndex);
+
+                                Manifold manifold = {};
+                                if (CollisionTests::CirclePoly(currentUnitCollider, blocker.tile.bakedCollider, manifold)) {
+                                    units.pos[unitIndex] -= manifold.normal * manifold.penetration;
+                                }
+                            }
                         }
                     }
                 }
+            }
 
-                if (debugDrawBoundsAndColliders.value) {
-                    const BoxBounds bounds = EntityGetBoundingBox(entity);
-                    const Circle collider = UnitGetCollider(entity);
-                    DrawShapeRect(WorldPosToScreenPos(bounds.min), WorldPosToScreenPos(bounds.max), glm::vec4(0.5f));
-                    DrawShapeCircle(WorldPosToScreenPos(collider.pos), WorldLengthToScreenLength(collider.rad), glm::vec4(0.5f));
-                }
-                if (debugDrawUnitRanges.value) {
-                    DrawShapeCircle(WorldPosToScreenPos(entity.pos), WorldLengthToScreenLength(firingRange), glm::vec4(1.0f, 0.4f, 0.4f, 0.5f) * 0.1f);
-                    DrawShapeCircle(WorldPosToScreenPos(entity.pos), WorldLengthToScreenLength(fieldOfView), glm::vec4(0.4f, 1.0f, 0.4f, 0.5f) * 0.1f);
-                }
+            if (debugDrawBoundsAndColliders.value) {
+                const BoxBounds bounds = UnitGetBoundingBox(currentMap, unitIndex);
+                const Circle collider = UnitGetCollider(currentMap, unitIndex);
+                DrawShapeRect(WorldPosToScreenPos(bounds.min), WorldPosToScreenPos(bounds.max), glm::vec4(0.5f));
+                DrawShapeCircle(WorldPosToScreenPos(collider.pos), WorldLengthToScreenLength(collider.rad), glm::vec4(0.5f));
+            }
+            if (debugDrawUnitRanges.value) {
+                DrawShapeCircle(WorldPosToScreenPos(units.pos[unitIndex]), WorldLengthToScreenLength(firingRange), glm::vec4(1.0f, 0.4f, 0.4f, 0.5f) * 0.1f);
+                DrawShapeCircle(WorldPosToScreenPos(units.pos[unitIndex]), WorldLengthToScreenLength(fieldOfView), glm::vec4(0.4f, 1.0f, 0.4f, 0.5f) * 0.1f);
             }
         }
 
+        MapFlushDestroyedEntities(currentMap);
+
+        updateTick++;
+
         if (debugDrawBoundsAndColliders.value) {
             const i32 blockerCapcity = currentMap->blockerTileEntities.GetCapcity();
             for (i32 blockerIndex = 0; blockerIndex < blockerCapcity; blockerIndex++) {
@@ -546,54 +574,90 @@ namespace atto {
 
     }
 
-    static i32 CompareSpriteDrawCommand(const void* a, const void* b) {
-        const DrawSpriteCommand* va = (const DrawSpriteCommand*)(a);
-        const DrawSpriteCommand* vb = (const DrawSpriteCommand*)(b);
-        return va->tileIndex < vb->tileIndex ? -1 : 1;
-    }
-
     void LeEngine::Render(AppState* app) {
         //ProfilerClock profilerClock("Render");
 
+        renderingStats = {};
+        Clock renderClock;
+        renderClock.Start();
+
+        spriteRenderingState.mode = debugUseSpriteInstancing.value ? SPRITE_RENDER_MODE_INSTANCED : SPRITE_RENDER_MODE_BATCHED;
+
+        StreamingVertexBufferBeginFrame();
+        DrawSubmitFrameUniforms();
         DrawClearSurface();
         DrawEnableAlphaBlending();
         //DrawSprite(AssetId::Creaste("starfield_02"), glm::vec2(0, 0), 0, 0);
         DrawSpriteClearCommands();
 
-        const i32 entityCapcity = currentMap->groundTileEntities.GetCapcity();
-        for (i32 entityIndex = 0; entityIndex < entityCapcity; entityIndex++) {
-            Entity& entity = currentMap->groundTileEntities[entityIndex];
-            if (entity.sprite1.active) {
-                DrawSprite(entity.sprite1.sprite, entity.pos, entity.rotation, 0, MapWorldPosToTilePos(currentMap, entity.pos));
+        // Only what overlaps the camera is submitted. The tile layers walk the tile range under the view and
+        // the units come from the unit grid, so nothing off screen is touched.
+        const BoxBounds visibleBounds = CameraGetVisibleWorldBounds();
+
+        DrawGroundChunks(currentMap, visibleBounds);
+
+        i32 submittedBlockerCount = 0;
+        BoxBounds blockerQueryBounds = visibleBounds;
+        blockerQueryBounds.min -= glm::vec2(currentMap->tileSpriteMaxExtent);
+        blockerQueryBounds.max += glm::vec2(currentMap->tileSpriteMaxExtent);
+
+        glm::ivec2 minTile = {};
+        glm::ivec2 maxTile = {};
+        if (MapWorldBoundsToTileRange(currentMap, blockerQueryBounds, minTile, maxTile)) {
+            // Tiles sort from their center, the position is the diamond's top corner
+            const glm::vec2 tileCenterOffset = glm::vec2(0.0f, -(f32)currentMap->tileHalfHeight);
+            for (i32 tileY = minTile.y; tileY <= maxTile.y; tileY++) {
+                for (i32 tileX = minTile.x; tileX <= maxTile.x; tileX++) {
+                    const Entity& entity = currentMap->blockerTileEntities[MapTilePosToIndex(currentMap, tileX, tileY)];
+                    if (entity.sprite1.active && visibleBounds.Intersects(DrawSpriteGetBounds(entity.sprite1.sprite, entity.pos, entity.rotation))) {
+                        DrawSprite(entity.sprite1.sprite, entity.pos, entity.rotation, entity.sprite1.currentFrameIndex, SPRITE_LAYER_WORLD, entity.pos + tileCenterOffset);
+                        submittedBlockerCount++;
+                    }
+                }
             }
         }
 
-        DrawSpriteRender();
-        DrawSpriteClearCommands();
-
-        const i32 blockerCapcity = currentMap->blockerTileEntities.GetCapcity();
-        for (i32 entityIndex = 0; entityIndex < entityCapcity; entityIndex++) {
-            Entity& entity = currentMap->blockerTileEntities[entityIndex];
-            if (entity.sprite1.active) {
-                DrawSprite(entity.sprite1.sprite, entity.pos, entity.rotation, 0, MapWorldPosToTilePos(currentMap, entity.pos));
+        i32 submittedUnitCount = 0;
+        const UnitStreams& units = currentMap->units;
+        auto submitUnit = [&](i32 unitIndex) {
+            if (!units.active[unitIndex]) {
+                return;
             }
-        }
 
-        const i32 unitEntityCapcity = currentMap->unitEntities.GetCapcity();
-        for (i32 entityIndex = 0; entityIndex < unitEntityCapcity; entityIndex++) {
-            Entity& entity = currentMap->unitEntities[entityIndex];
-            if (entity.unit.active && entity.unit.isSelected) {
-                if (entity.sprite2.active) {
-                    DrawSprite(entity.sprite2.sprite, entity.pos, entity.rotation, 0, MapWorldPosToTilePos(currentMap, entity.pos));
-                }
+            // The selection sprite can be bigger than the unit's, so each is tested against its own bounds
+            const glm::vec2 unitPos = units.pos[unitIndex];
+            const f32 unitRotation = units.rotation[unitIndex];
+            SpriteAsset* selectionSprite = units.selectionSprite[unitIndex];
+            if (units.isSelected[unitIndex] && selectionSprite != nullptr && visibleBounds.Intersects(DrawSpriteGetBounds(selectionSprite, unitPos, unitRotation))) {
+                DrawSprite(selectionSprite, unitPos, unitRotation, 0, SPRITE_LAYER_GROUND_DECAL, unitPos);
             }
 
-            if (entity.sprite1.active) {
-                DrawSprite(entity.sprite1.sprite, entity.pos, entity.rotation, entity.sprite1.currentFrameIndex, MapWorldPosToTilePos(currentMap, entity.pos));
+            SpriteAsset* unitSprite = units.sprite[unitIndex];
+            if (unitSprite != nullptr && visibleBounds.Intersects(DrawSpriteGetBounds(unitSprite, unitPos, unitRotation))) {
+                DrawSprite(unitSprite, unitPos, unitRotation, units.spriteFrameIndex[unitIndex], SPRITE_LAYER_WORLD, unitPos);
+                submittedUnitCount++;
             }
+        };
+
+        // The grid was built at the start of the update and units have moved since, one cell of slack covers that.
+        // Its cells are sized for collisions, so when the view covers more cells than there are units it's cheaper
+        // to test every unit than to visit every cell.
+        const glm::vec2 unitQueryReach = glm::vec2(currentMap->unitGridMaxSpriteExtent + currentMap->unitGrid.GetCellSize());
+        const glm::vec2 unitQueryMin = visibleBounds.min - unitQueryReach;
+        const glm::vec2 unitQueryMax = visibleBounds.max + unitQueryReach;
+        const glm::ivec2 unitQueryCells = currentMap->unitGrid.GetCell(unitQueryMax) - currentMap->unitGrid.GetCell(unitQueryMin) + 1;
+        const i64 unitQueryCellCount = (i64)unitQueryCells.x * (i64)unitQueryCells.y;
+        const i32 aliveUnitCount = units.aliveSlots.GetCount();
+        if (unitQueryCellCount > aliveUnitCount) {
+            for (i32 aliveIndex = 0; aliveIndex < aliveUnitCount; aliveIndex++) {
+                submitUnit(units.aliveSlots[aliveIndex]);
+            }
+        }
+        else {
+            currentMap->unitGrid.Query(unitQueryMin, unitQueryMax, submitUnit);
         }
 
-        qsort(spriteRenderingState.commands.GetData(), spriteRenderingState.commands.GetCount(), sizeof(DrawSpriteCommand), CompareSpriteDrawCommand);
+        renderingStats.spriteCulledCount = (currentMap->blockerCount - submittedBlockerCount) + (units.aliveSlots.GetCount() - submittedUnitCount);
 
         DrawSpriteRender();
 
@@ -648,14 +712,29 @@ namespace atto {
                     DrawTextSetHalign(FONT_HALIGN_CENTER);
                     DrawText(text, screenCenter);
 #elif 1 
-                    SmallString text = StringFormat::Small("%d", MapTilePosToIndex(currentMap, x, y));
+                    const i32 tileIndex = MapTilePosToIndex(currentMap, x, y);
                     DrawTextSetHalign(FONT_HALIGN_CENTER);
-                    DrawText(text, screenCenter);
+                    DrawText(textRenderingState.tileIndexLabels[tileIndex].GetCStr(), screenCenter);
 #endif
                 }
             }
         }
 
+        if (debugDrawRenderingStats.value) {
+            // Last frame's, this one is still being counted
+            const RenderingStats& stats = lastFrameRenderingStats;
+            DrawTextSetHalign(FONT_HALIGN_LEFT);
+            DrawText(StringFormat::Small("draw calls %d", stats.drawCallCount), glm::vec2(10, mainSurfaceHeight - 20));
+            DrawText(StringFormat::Small("sprites %d in %d batches, %d bytes uploaded (%s)", stats.spriteCount, stats.spriteBatchCount, stats.spriteUploadBytes,
+                spriteRenderingState.mode == SPRITE_RENDER_MODE_INSTANCED ? "instanced" : "batched"), glm::vec2(10, mainSurfaceHeight - 40));
+            DrawText(StringFormat::Small("culled %d sprites, %d ground chunks", stats.spriteCulledCount, stats.groundChunkCulledCount), glm::vec2(10, mainSurfaceHeight - 60));
+            DrawText(StringFormat::Small("ground chunks %d", stats.groundChunkCount), glm::vec2(10, mainSurfaceHeight - 80));
+            DrawText(StringFormat::Small("gl state changes %d, %d skipped", stats.stateChangeCount, stats.stateChangeSkippedCount), glm::vec2(10, mainSurfaceHeight - 100));
+            DrawText(StringFormat::Small("streamed %d bytes, waited on the gpu %d times", stats.streamedBytes, stats.streamingWaitCount), glm::vec2(10, mainSurfaceHeight - 120));
+            DrawText(StringFormat::Small("text layouts %d cached, %d built", stats.textLayoutHitCount, stats.textLayoutMissCount), glm::vec2(10, mainSurfaceHeight - 140));
+            DrawText(StringFormat::Small("render cpu %f ms", stats.renderMicroseconds / 1000.0), glm::vec2(10, mainSurfaceHeight - 160));
+        }
+
         //glm::vec2 mousePos = app->input->mousePosPixels;
         glm::vec2 pos = GetMousePosWorldSpace();
 
@@ -677,10 +756,20 @@ namespace atto {
         //DrawSprite(AssetId::Create("ship_b"), pos, r, 0);
 
         DrawShapeRender();
+        DrawTextRender();
         DrawUIRender(app);
 
+        // The UI backend binds its own program, buffers and blend state
+        RenderStateInvalidate();
+
         DEBUGPushLine(glm::vec2(0, 0), glm::vec2(100, 0));
         DEBUGSubmit();
+
+        StreamingVertexBufferEndFrame();
+
+        renderClock.End();
+        renderingStats.renderMicroseconds = renderClock.GetElapsedMicroseconds();
+        lastFrameRenderingStats = renderingStats;
     }
 
     void LeEngine::Shutdown() {
@@ -782,12 +871,35 @@ namespace atto {
         return ScreenPosToWorldPos(app->input->mousePosPixels);
     }
 
-    Circle LeEngine::UnitGetCollider(const Entity& unit) {
-        Circle collider = unit.unit.localColldier;
-        collider.pos += unit.pos;
+    BoxBounds LeEngine::CameraGetVisibleWorldBounds() {
+        const glm::mat4 inverseViewProjection = glm::inverse(cameraProjection * cameraView);
+        const glm::vec2 clipCorners[] = { glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1) };
+
+        BoxBounds bounds = {};
+        bounds.min = glm::vec2(FLT_MAX);
+        bounds.max = glm::vec2(-FLT_MAX);
+        for (const glm::vec2& clipCorner : clipCorners) {
+            const glm::vec4 worldCorner = inverseViewProjection * glm::vec4(clipCorner, 0.0f, 1.0f);
+            bounds.min = glm::min(bounds.min, glm::vec2(worldCorner));
+            bounds.max = glm::max(bounds.max, glm::vec2(worldCorner));
+        }
+
+        return bounds;
+    }
+
+    Circle LeEngine::UnitGetCollider(Map* map, i32 unitIndex) {
+        Circle collider = {};
+        collider.pos = map->units.pos[unitIndex];
+        collider.rad = map->units.colliderRad[unitIndex];
         return collider;
     }
 
+    BoxBounds LeEngine::UnitGetBoundingBox(Map* map, i32 unitIndex) {
+        BoxBounds bounds = map->units.localBoundingBox[unitIndex];
+        bounds.Translate(map->units.pos[unitIndex]);
+        return bounds;
+    }
+
     glm::vec2 LeEngine::UnitSteerSeek(const Entity& unitEntity, glm::vec2 target) {
         const f32 maxSpeed = 50.0f;
 
@@ -832,6 +944,11 @@ namespace atto {
         return bounds;
     }
 
+    // Distance from a sprite's position to the furthest corner of its frame can't be more than the frame's diagonal, whatever the origin or rotation
+    static f32 SpriteGetMaxExtent(const SpriteAsset* spriteAsset) {
+        return spriteAsset != nullptr ? glm::length(spriteAsset->frameSize) : 0.0f;
+    }
+
     void LeEngine::MapCreate(Map* map, const char* mapData, i32 mapWidth, i32 mapHeight) {
         map->mapWidth = mapWidth;
         map->mapHeight = mapHeight;
@@ -839,6 +956,14 @@ namespace atto {
         map->tileHeight = 16;
         map->tileHalfWidth = map->tileWidth / 2;
         map->tileHalfHeight = map->tileHeight / 2;
+        map->tileSpriteMaxExtent = 0.0f;
+        map->blockerCount = 0;
+        Assert(mapWidth * mapHeight <= FlowField::CAPCITY, "Map is to big for a flow field");
+
+        map->version++;
+        for (i32 flowFieldIndex = 0; flowFieldIndex < Map::FLOW_FIELD_CACHE_COUNT; flowFieldIndex++) {
+            map->flowFields[flowFieldIndex].valid = false;
+        }
 
         for (i32 y = 0; y < map->mapHeight; y++) {
             for (i32 x = 0; x < map->mapWidth; x++) {
@@ -848,27 +973,15 @@ namespace atto {
                 entity.pos = MapTilePosToWorldPos(map, glm::vec2(x, y));
                 entity.sprite1.active = true;
                 entity.sprite1.sprite = GetSpriteAsset(AssetId::Create("tile_test"));
+                map->tileSpriteMaxExtent = glm::max(map->tileSpriteMaxExtent, SpriteGetMaxExtent(entity.sprite1.sprite));
 
                 map->groundTileEntities.Add(entity);
             }
         }
 
-        PolygonCollider blockerCollider = {};
-
-        glm::vec2 tilePos1 = glm::vec2(0, 0);
-        glm::vec2 tilePos2 = glm::vec2(1, 0);
-        glm::vec2 tilePos3 = glm::vec2(0, 1);
-        glm::vec2 tilePos4 = glm::vec2(1, 1);
+        MapCreateGroundChunks(map);
 
-        glm::vec2 worldPos1 = MapTilePosToWorldPos(map, tilePos1);
-        glm::vec2 worldPos2 = MapTilePosToWorldPos(map, tilePos2);
-        glm::vec2 worldPos3 = MapTilePosToWorldPos(map, tilePos3);
-        glm::vec2 worldPos4 = MapTilePosToWorldPos(map, tilePos4);
-
-        blockerCollider.vertices.Add(worldPos1);
-        blockerCollider.vertices.Add(worldPos3);
-        blockerCollider.vertices.Add(worldPos4);
-        blockerCollider.vertices.Add(worldPos2);
+        const PolygonCollider blockerCollider = MapCreateBlockerCollider(map);
 
         for (i32 y = 0; y < map->mapHeight; y++) {
             for (i32 x = 0; x < map->mapWidth; x++) {
@@ -883,58 +996,130 @@ namespace atto {
                 if (tileType == '1') {
                     entity.tile.isBlocker = true;
                     entity.tile.collider = blockerCollider;
+                    entity.tile.bakedCollider.Bake(BlockerGetCollider(entity));
                     entity.sprite1.active = true;
                     entity.sprite1.sprite = GetSpriteAsset(AssetId::Create("tile_blocker"));
+                    map->tileSpriteMaxExtent = glm::max(map->tileSpriteMaxExtent, SpriteGetMaxExtent(entity.sprite1.sprite));
+                    map->blockerCount++;
                 }
 
                 map->blockerTileEntities.Add(entity);
             }
         }
 
-        const i32 entityCapcity = map->unitEntities.GetCapcity();
-        for (i32 entityIndex = 0; entityIndex < entityCapcity; entityIndex++) {
-            Entity& entity = map->unitEntities[entityIndex];
-            entity.id = ENTITY_ID_INVALID;
+        map->pathGrid.Create(mapWidth, mapHeight);
+        for (i32 y = 0; y < map->mapHeight; y++) {
+            for (i32 x = 0; x < map->mapWidth; x++) {
+                map->pathGrid.SetWalkable(x, y, !map->blockerTileEntities[MapTilePosToIndex(map, x, y)].tile.isBlocker);
+            }
+        }
+
+        map->pathHierarchy.Build(&map->pathGrid, Map::PATH_CLUSTER_SIZE);
+        map->pathRequests.Clear();
+
+        for (i32 pathIndex = 0; pathIndex < Map::UNIT_PATH_CAPCITY; pathIndex++) {
+            map->unitPaths[pathIndex].inUse = false;
+        }
+
+        UnitStreams& units = map->units;
+        units.freeSlots.Clear();
+        units.aliveSlots.Clear();
+        units.pendingDestroySlots.Clear();
+
+        // Pushed in reverse so the lowest slots are handed out first
+        for (i32 unitIndex = Map::UNIT_CAPCITY - 1; unitIndex >= 0; unitIndex--) {
+            units.id[unitIndex] = ENTITY_ID_INVALID;
+            units.active[unitIndex] = false;
+            units.generation[unitIndex] = 1;
+            units.alivePosition[unitIndex] = -1;
+            units.freeSlots.Add(unitIndex);
         }
     }
 
-    Entity* LeEngine::MapCreateEntity() {
-        const i32 entityCapcity = currentMap->unitEntities.GetCapcity();
-        for (i32 entityIndex = 0; entityIndex < entityCapcity; entityIndex++) {
-            Entity& entity = currentMap->unitEntities[entityIndex];
-            if (entity.id == ENTITY_ID_INVALID) {
-                entity.id.generation = 1;
-                entity.id.index = entityIndex;
+    static void UnitStreamsClearSlot(UnitStreams& units, i32 unitIndex) {
+        units.id[unitIndex] = ENTITY_ID_INVALID;
+        units.active[unitIndex] = false;
+        units.pos[unitIndex] = glm::vec2(0.0f);
+        units.vel[unitIndex] = glm::vec2(0.0f);
+        units.colliderRad[unitIndex] = 0.0f;
+        units.teamNumber[unitIndex] = 0;
+        units.health[unitIndex] = 0;
+        units.target[unitIndex] = {};
+        units.timeToNextFire[unitIndex] = 0.0f;
+        units.timeFiring[unitIndex] = 0.0f;
+        units.spriteFrameIndex[unitIndex] = 0;
+        units.pathIndex[unitIndex] = -1;
+        units.pathRequest[unitIndex] = {};
+        units.pathRequest[unitIndex].index = -1;
+        units.isSelected[unitIndex] = false;
+        units.rotation[unitIndex] = 0.0f;
+        units.localBoundingBox[unitIndex] = {};
+        units.sprite[unitIndex] = nullptr;
+        units.selectionSprite[unitIndex] = nullptr;
+    }
 
-                return &entity;
-            }
+    EntityId LeEngine::MapCreateEntity() {
+        UnitStreams& units = currentMap->units;
+        if (units.freeSlots.IsEmpty()) {
+            Assert(0, "Map, to many units");
+            return ENTITY_ID_INVALID;
         }
 
-        Assert(0, "not sure if theis is allowed");
+        const i32 freeCount = units.freeSlots.GetCount();
+        const i32 unitIndex = units.freeSlots[freeCount - 1];
+        units.freeSlots.SetCount(freeCount - 1);
 
-        return nullptr;
+        UnitStreamsClearSlot(units, unitIndex);
+        units.id[unitIndex].index = unitIndex;
+        units.id[unitIndex].generation = units.generation[unitIndex];
+
+        units.alivePosition[unitIndex] = units.aliveSlots.GetCount();
+        units.aliveSlots.Add(unitIndex);
+
+        return units.id[unitIndex];
     }
 
-    Entity* LeEngine::MapGetEntity(const EntityId& id) {
-        if (id != ENTITY_ID_INVALID) {
-            const EntityId& otherId = currentMap->unitEntities[id.index].id;
-            if (otherId == id) {
-                return &currentMap->unitEntities[id.index];
+    i32 LeEngine::MapGetEntity(const EntityId& id) {
+        if (id.index >= 0 && id.index < Map::UNIT_CAPCITY) {
+            if (currentMap->units.id[id.index] == id) {
+                return id.index;
             }
         }
-        return nullptr;
+        return -1;
     }
 
-    void LeEngine::MapDestroyEntity(Entity* entity) {
-        if (entity != nullptr) {
-            if (entity->id != ENTITY_ID_INVALID) {
-                Entity* placedEntity = &currentMap->unitEntities[entity->id.index];
-                if (entity->id == placedEntity->id) {
-                    *placedEntity = {};
-                    placedEntity->id = ENTITY_ID_INVALID;
-                }
-            }
+    void LeEngine::MapDestroyEntity(const EntityId& id) {
+        const i32 unitIndex = MapGetEntity(id);
+        if (unitIndex != -1) {
+            UnitStreams& units = currentMap->units;
+            units.generation[unitIndex]++;
+            units.id[unitIndex] = ENTITY_ID_INVALID;
+            units.active[unitIndex] = false;
+            units.pendingDestroySlots.Add(unitIndex);
+        }
+    }
+
+    void LeEngine::MapFlushDestroyedEntities(Map* map) {
+        UnitStreams& units = map->units;
+        const i32 pendingCount = units.pendingDestroySlots.GetCount();
+        for (i32 pendingIndex = 0; pendingIndex < pendingCount; pendingIndex++) {
+            const i32 unitIndex = units.pendingDestroySlots[pendingIndex];
+            MapReleaseUnitPath(map, unitIndex);
+
+            // Swap the last live slot into the hole
+            const i32 position = units.alivePosition[unitIndex];
+            const i32 lastPosition = units.aliveSlots.GetCount() - 1;
+            const i32 lastUnitIndex = units.aliveSlots[lastPosition];
+            units.aliveSlots[position] = lastUnitIndex;
+            units.alivePosition[lastUnitIndex] = position;
+            units.aliveSlots.SetCount(lastPosition);
+
+            UnitStreamsClearSlot(units, unitIndex);
+            units.alivePosition[unitIndex] = -1;
+            units.freeSlots.Add(unitIndex);
         }
+
+        units.pendingDestroySlots.Clear();
     }
 
     glm::vec2 LeEngine::MapTilePosToWorldPos(Map* map, glm::vec2 tilePos) {
@@ -963,6 +1148,138 @@ namespace atto {
         return index;
     }
 
+    bool LeEngine::MapWorldBoundsToTileRange(Map* map, const BoxBounds& worldBounds, glm::ivec2& minTile, glm::ivec2& maxTile) {
+        // Tiles are diamonds in world space, so all four corners are needed to cover the box
+        const glm::vec2 corner1 = MapWorldPosToTilePos(map, worldBounds.min);
+        const glm::vec2 corner2 = MapWorldPosToTilePos(map, worldBounds.max);
+        const glm::vec2 corner3 = MapWorldPosToTilePos(map, glm::vec2(worldBounds.min.x, worldBounds.max.y));
+        const glm::vec2 corner4 = MapWorldPosToTilePos(map, glm::vec2(worldBounds.max.x, worldBounds.min.y));
+
+        const glm::vec2 tileMin = glm::min(glm::min(corner1, corner2), glm::min(corner3, corner4));
+        const glm::vec2 tileMax = glm::max(glm::max(corner1, corner2), glm::max(corner3, corner4));
+
+        minTile.x = glm::max((i32)tileMin.x, 0);
+        minTile.y = glm::max((i32)tileMin.y, 0);
+        maxTile.x = glm::min((i32)tileMax.x, map->mapWidth - 1);
+        maxTile.y = glm::min((i32)tileMax.y, map->mapHeight - 1);
+
+        return minTile.x <= maxTile.x && minTile.y <= maxTile.y;
+    }
+
+    PolygonCollider LeEngine::MapCreateBlockerCollider(Map* map) {
+        PolygonCollider collider = {};
+        collider.vertices.Add(MapTilePosToWorldPos(map, glm::vec2(0, 0)));
+        collider.vertices.Add(MapTilePosToWorldPos(map, glm::vec2(0, 1)));
+        collider.vertices.Add(MapTilePosToWorldPos(map, glm::vec2(1, 1)));
+        collider.vertices.Add(MapTilePosToWorldPos(map, glm::vec2(1, 0)));
+
+        return collider;
+    }
+
+    void LeEngine::MapSetTileBlocker(Map* map, i32 x, i32 y, bool isBlocker) {
+        Assert(x >= 0 && x < map->mapWidth && y >= 0 && y < map->mapHeight, "MapSetTileBlocker, tile is off the map");
+
+        Entity& entity = map->blockerTileEntities[MapTilePosToIndex(map, x, y)];
+        if (entity.tile.isBlocker == isBlocker) {
+            return;
+        }
+
+        entity.tile.isBlocker = isBlocker;
+        entity.sprite1.active = isBlocker;
+        if (isBlocker) {
+            entity.tile.collider = MapCreateBlockerCollider(map);
+            entity.tile.bakedCollider.Bake(BlockerGetCollider(entity));
+            entity.sprite1.sprite = GetSpriteAsset(AssetId::Create("tile_blocker"));
+            map->tileSpriteMaxExtent = glm::max(map->tileSpriteMaxExtent, SpriteGetMaxExtent(entity.sprite1.sprite));
+        }
+
+        map->blockerCount += isBlocker ? 1 : -1;
+        map->version++;
+        map->pathGrid.SetWalkable(x, y, !isBlocker);
+        map->pathHierarchy.UpdateTile(x, y);
+    }
+
+    void LeEngine::MapCreateGroundChunks(Map* map) {
+        // The map could have been created before, don't leak the old chunks' buffers
+        for (i32 chunkIndex = 0; chunkIndex < map->groundChunks.GetNum(); chunkIndex++) {
+            VertexBufferFree(&map->groundChunks[chunkIndex].vertexBuffer);
+        }
+
+        const i32 chunkSize = Map::GROUND_CHUNK_SIZE;
+        map->groundChunksWide = (map->mapWidth + chunkSize - 1) / chunkSize;
+        map->groundChunksHigh = (map->mapHeight + chunkSize - 1) / chunkSize;
+        map->groundChunks.SetNum(map->groundChunksWide * map->groundChunksHigh);
+
+        const i32 vertexCapcity = chunkSize * chunkSize * SpriteRenderingState::VERTICES_PER_SPRITE;
+        for (i32 chunkY = 0; chunkY < map->groundChunksHigh; chunkY++) {
+            for (i32 chunkX = 0; chunkX < map->groundChunksWide; chunkX++) {
+                GroundChunk& chunk = map->groundChunks[chunkY * map->groundChunksWide + chunkX];
+                chunk.minTile = glm::ivec2(chunkX, chunkY) * chunkSize;
+                chunk.maxTile = glm::min(chunk.minTile + glm::ivec2(chunkSize - 1), glm::ivec2(map->mapWidth - 1, map->mapHeight - 1));
+                chunk.vertexCount = 0;
+                chunk.vertexBuffer = SubmitVertexBuffer(vertexCapcity * sizeof(SpriteVertex), nullptr, VERTEX_LAYOUT_TYPE_SPRITE, false);
+                chunk.batches.Clear();
+                MapBuildGroundChunk(map, chunk);
+            }
+        }
+    }
+
+    void LeEngine::MapBuildGroundChunk(Map* map, GroundChunk& chunk) {
+        static FixedList<DrawSpriteCommand, Map::GROUND_CHUNK_SIZE * Map::GROUND_CHUNK_SIZE> commands = {};
+        commands.Clear();
+
+        // Ordered by tileX + tileY, the same depth the sprite sort uses, then by texture. Depths are whole
+        // tiles here so there is no need to go through the world position.
+        for (i32 y = chunk.minTile.y; y <= chunk.maxTile.y; y++) {
+            for (i32 x = chunk.minTile.x; x <= chunk.maxTile.x; x++) {
+                const Entity& entity = map->groundTileEntities[MapTilePosToIndex(map, x, y)];
+                if (!entity.sprite1.active || !DrawSpriteLoadTexture(entity.sprite1.sprite)) {
+                    continue;
+                }
+
+                DrawSpriteCommand cmd = DrawSpriteCreateCommand();
+                cmd.spriteAsset = entity.sprite1.sprite;
+                cmd.position = entity.pos;
+                cmd.rotation = entity.rotation;
+                cmd.sortKey = ((u64)(x + y) << 32) | (entity.sprite1.sprite->texture->textureHandle & 0xFFFF);
+                commands.Add(cmd);
+            }
+        }
+
+        const i32 commandCount = commands.GetCount();
+        List<DrawSpriteCommand>& sortedCommands = spriteRenderingState.sortedCommands;
+        DrawSpriteSortCommands(commands.GetData(), commandCount, sortedCommands);
+
+        List<SpriteVertex>& vertices = spriteRenderingState.vertices;
+        vertices.SetNum(commandCount * SpriteRenderingState::VERTICES_PER_SPRITE, false);
+
+        chunk.vertexCount = DrawSpriteBuildVertices(sortedCommands.GetData(), commandCount, vertices.GetData(), chunk.batches);
+
+        chunk.bounds.min = glm::vec2(FLT_MAX);
+        chunk.bounds.max = glm::vec2(-FLT_MAX);
+        for (i32 batchIndex = 0; batchIndex < chunk.batches.GetNum(); batchIndex++) {
+            const SpriteBatch& batch = chunk.batches[batchIndex];
+            for (i32 vertexIndex = batch.first; vertexIndex < batch.first + batch.count; vertexIndex++) {
+                const glm::vec2 position = batch.origin + glm::vec2(vertices[vertexIndex].position[0], vertices[vertexIndex].position[1]) / (f32)SpriteVertex::POSITION_SCALE;
+                chunk.bounds.min = glm::min(chunk.bounds.min, position);
+                chunk.bounds.max = glm::max(chunk.bounds.max, position);
+            }
+        }
+
+        if (chunk.vertexCount > 0) {
+            VertexBufferUpdate(chunk.vertexBuffer, 0, chunk.vertexCount * sizeof(SpriteVertex), vertices.GetData());
+        }
+
+    }
+
+    bool LeEngine::MapIsTileWalkable(Map* map, i32 x, i32 y) {
+        if (x < 0 || x >= map->mapWidth || y < 0 || y >= map->mapHeight) {
+            return false;
+        }
+
+        return !map->blockerTileEntities[MapTilePosToIndex(map, x, y)].tile.isBlocker;
+    }
+
     MapTile* LeEngine::MapGetTile(Map* map, glm::vec2 tilePos) {
         i32 index = MapTilePosToIndex(map, tilePos);
         if (index >= 0 && index < map->mapWidth * map->mapHeight) {
@@ -1025,76 +1342,429 @@ namespace atto {
         MapGetTileNeighbors(map, tile->tileX, tile->tileY, neighbors);
     }
 
-    const void* LeEngine::LoadEngineAsset(AssetId id, AssetType type) {
-        const i32 count = engineAssets.GetCount();
-        for (i32 assetIndex = 0; assetIndex < count; ++assetIndex) {
-            EngineAsset& asset = engineAssets[assetIndex];
-
-            if (!asset.id.IsValid()) {
-                break;
+    void LeEngine::MapStepSpriteAnimations(Map* map, f32 dt) {
+        // Ground tiles are baked into their chunks, so only the blockers animate
+        const i32 entityCount = map->blockerTileEntities.GetCapcity();
+        for (i32 entityIndex = 0; entityIndex < entityCount; entityIndex++) {
+            EntitySprite& entitySprite = map->blockerTileEntities[entityIndex].sprite1;
+            if (entitySprite.active && entitySprite.sprite->animated) {
+                entitySprite.StepAnimation(dt);
             }
+        }
+    }
 
-            if (asset.id == id && asset.type == type) {
-                switch (asset.type) {
-                case ASSET_TYPE_TEXTURE: {
-                    if (asset.texture.textureHandle != 0) {
-                        return &asset.texture;
-                    }
+    void EntitySprite::StepAnimation(f32 dt) {
+        const i32 frameCount = sprite->frameUVs.GetCount();
+        if (animationDuration <= 0.0f) {
+            animationDuration = sprite->frameDuration * frameCount;
+        }
 
-                    if (LoadTextureAsset(asset.path.GetCStr(), asset.texture)) {
-                        ATTOTRACE("Loaded texture asset %s", asset.path.GetCStr());
-                        return &asset.texture;
-                    }
-                } break;
+        // The playhead can round to just under the duration, which would be one frame past the end
+        animationPlayhead = fmodf(animationPlayhead + dt, animationDuration);
+        currentFrameIndex = glm::min((i32)(animationPlayhead / animationDuration * frameCount), frameCount - 1);
+    }
 
-                case ASSET_TYPE_AUDIO: {
-                    if (asset.audio.bufferHandle != 0) {
-                        return &asset.audio;
-                    }
+    void LeEngine::MapRebuildUnitGrid(Map* map) {
+        const UnitStreams& units = map->units;
 
-                    if (LoadAudioAsset(asset.path.GetCStr(), asset.audio)) {
-                        ATTOTRACE("Loaded audio sasset %s", asset.path.GetCStr());
-                        return &asset.audio;
-                    }
-                } break;
+        const i32 aliveCount = units.aliveSlots.GetCount();
 
-                case ASSET_TYPE_FONT: {
-                    if (asset.font.textureHandle != 0) {
-                        return &asset.font;
-                    }
+        f32 maxRadius = 0.0f;
+        f32 maxSpriteExtent = 0.0f;
+        for (i32 aliveIndex = 0; aliveIndex < aliveCount; aliveIndex++) {
+            const i32 unitIndex = units.aliveSlots[aliveIndex];
+            if (units.active[unitIndex]) {
+                maxRadius = glm::max(maxRadius, units.colliderRad[unitIndex]);
+                maxSpriteExtent = glm::max(maxSpriteExtent, SpriteGetMaxExtent(units.sprite[unitIndex]));
+                maxSpriteExtent = glm::max(maxSpriteExtent, SpriteGetMaxExtent(units.selectionSprite[unitIndex]));
+            }
+        }
 
-                    if (LoadFontAsset(asset.path.GetCStr(), asset.font)) {
-                        ATTOTRACE("Loaded font asset %s", asset.path.GetCStr());
-                        return &asset.font;
-                    }
-                } break;
+        // Cells at least one diameter wide means a unit can only touch units in the neighbouring cells
+        map->unitGridMaxRadius = maxRadius;
+        map->unitGridMaxSpriteExtent = maxSpriteExtent;
+        map->unitGrid.Begin(glm::max(maxRadius * 2.0f, 1.0f));
 
-                default: {
-                    Assert(0, "");
-                }
-                }
+        for (i32 aliveIndex = 0; aliveIndex < aliveCount; aliveIndex++) {
+            const i32 unitIndex = units.aliveSlots[aliveIndex];
+            if (units.active[unitIndex]) {
+                map->unitGrid.Insert(unitIndex, units.pos[unitIndex]);
             }
         }
 
-        return nullptr;
+        map->unitGrid.End();
     }
 
-    PolygonCollider LeEngine::BlockerGetCollider(const Entity& entity) {
-        PolygonCollider collider = entity.tile.collider;
-        collider.Translate(entity.pos);
+    void LeEngine::MapRebuildTeamGrids(Map* map, f32 cellSize) {
+        const UnitStreams& units = map->units;
+        const i32 aliveCount = units.aliveSlots.GetCount();
 
-        return collider;
-    }
+        for (i32 teamIndex = 0; teamIndex < Map::TEAM_COUNT; teamIndex++) {
+            map->teamGrids[teamIndex].Begin(cellSize);
+        }
 
-    TextureAsset* LeEngine::LoadTextureAsset(TextureAssetId id) {
-        return (TextureAsset*)LoadEngineAsset(id.ToRawId(), ASSET_TYPE_TEXTURE);
-    }
+        for (i32 aliveIndex = 0; aliveIndex < aliveCount; aliveIndex++) {
+            const i32 unitIndex = units.aliveSlots[aliveIndex];
+            if (units.active[unitIndex]) {
+                const i32 teamIndex = units.teamNumber[unitIndex];
+                Assert(teamIndex < Map::TEAM_COUNT, "Unit has an invalid team");
+                map->teamGrids[teamIndex].Insert(unitIndex, units.pos[unitIndex]);
+            }
+        }
 
-    FontAsset* LeEngine::LoadFontAsset(FontAssetId id) {
-        return (FontAsset*)LoadEngineAsset(id.ToRawId(), ASSET_TYPE_FONT);
+        for (i32 teamIndex = 0; teamIndex < Map::TEAM_COUNT; teamIndex++) {
+            map->teamGrids[teamIndex].End();
+        }
     }
 
-    AudioAsset* LeEngine::LoadAudioAsset(AudioAssetId id) {
+    i32 LeEngine::MapFindNearestEnemy(Map* map, i32 unitIndex, f32 radius) {
+        const UnitStreams& units = map->units;
+        const glm::vec2 unitPos = units.pos[unitIndex];
+        const i32 unitTeamIndex = units.teamNumber[unitIndex];
+
+        i32 nearestUnitIndex = -1;
+        f32 nearestDistanceSqrd = radius * radius;
+        for (i32 teamIndex = 0; teamIndex < Map::TEAM_COUNT; teamIndex++) {
+            if (teamIndex == unitTeamIndex) {
+                continue;
+            }
+
+            map->teamGrids[teamIndex].QueryRadius(unitPos, radius, [&](i32 otherUnitIndex) {
+                // Units killed earlier this update are still in the grid
+                if (units.active[otherUnitIndex]) {
+                    const f32 d = glm::distance2(unitPos, units.pos[otherUnitIndex]);
+                    if (d < nearestDistanceSqrd) {
+                        nearestDistanceSqrd = d;
+                        nearestUnitIndex = otherUnitIndex;
+                    }
+                }
+            });
+        }
+
+        return nearestUnitIndex;
+    }
+
+    FlowField* LeEngine::MapGetFlowField(Map* map, i32 destinationTileX, i32 destinationTileY) {
+        if (destinationTileX < 0 || destinationTileX >= map->mapWidth || destinationTileY < 0 || destinationTileY >= map->mapHeight) {
+            return nullptr;
+        }
+
+        if (map->blockerTileEntities[MapTilePosToIndex(map, destinationTileX, destinationTileY)].tile.isBlocker) {
+            return nullptr;
+        }
+
+        FlowField* leastRecentlyUsed = &map->flowFields[0];
+        for (i32 flowFieldIndex = 0; flowFieldIndex < Map::FLOW_FIELD_CACHE_COUNT; flowFieldIndex++) {
+            FlowField* flowField = &map->flowFields[flowFieldIndex];
+            if (flowField->valid && flowField->mapVersion == map->version &&
+                flowField->destinationTileX == destinationTileX && flowField->destinationTileY == destinationTileY) {
+                flowField->lastUsedTick = updateTick;
+                return flowField;
+            }
+
+            if (!flowField->valid) {
+                leastRecentlyUsed = flowField;
+            }
+            else if (leastRecentlyUsed->valid && flowField->lastUsedTick < leastRecentlyUsed->lastUsedTick) {
+                leastRecentlyUsed = flowField;
+            }
+        }
+
+        MapBuildFlowField(map, leastRecentlyUsed, destinationTileX, destinationTileY);
+        leastRecentlyUsed->lastUsedTick = updateTick;
+
+        return leastRecentlyUsed;
+    }
+
+    void LeEngine::MapBuildFlowField(Map* map, FlowField* flowField, i32 destinationTileX, i32 destinationTileY) {
+        const i32 tileCount = map->mapWidth * map->mapHeight;
+
+        flowField->valid = true;
+        flowField->destinationTileX = destinationTileX;
+        flowField->destinationTileY = destinationTileY;
+        flowField->mapVersion = map->version;
+
+        for (i32 tileIndex = 0; tileIndex < tileCount; tileIndex++) {
+            flowField->integration[tileIndex] = FlowField::UNREACHABLE;
+            flowField->direction[tileIndex] = glm::vec2(0.0f);
+        }
+
+        const i32 neighborOffsetsX[8] = { 0, 0, -1, 1, -1, 1, -1, 1 };
+        const i32 neighborOffsetsY[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+        const i32 neighborCosts[8] = { 10, 10, 10, 10, 14, 14, 14, 14 };
+
+        // Integration field, costs only ever go down so a tile is re-queued whenever it improves
+        static FixedQueue<i32, FlowField::CAPCITY> frontier = {};
+        static bool inFrontier[FlowField::CAPCITY] = {};
+        frontier.Clear();
+
+        const i32 destinationIndex = MapTilePosToIndex(map, destinationTileX, destinationTileY);
+        flowField->integration[destinationIndex] = 0;
+        frontier.Enqueue(destinationIndex);
+        inFrontier[destinationIndex] = true;
+
+        while (!frontier.IsEmpty()) {
+            const i32 tileIndex = frontier.Dequeue();
+            inFrontier[tileIndex] = false;
+
+            const i32 tileX = tileIndex % map->mapWidth;
+            const i32 tileY = tileIndex / map->mapWidth;
+            const i32 tileCost = flowField->integration[tileIndex];
+
+            for (i32 neighborIndex = 0; neighborIndex < 8; neighborIndex++) {
+                const i32 neighborX = tileX + neighborOffsetsX[neighborIndex];
+                const i32 neighborY = tileY + neighborOffsetsY[neighborIndex];
+                if (!MapIsTileWalkable(map, neighborX, neighborY)) {
+                    continue;
+                }
+
+                // Don't cut diagonally past the corner of a blocker
+                if (neighborOffsetsX[neighborIndex] != 0 && neighborOffsetsY[neighborIndex] != 0) {
+                    if (!MapIsTileWalkable(map, neighborX, tileY) || !MapIsTileWalkable(map, tileX, neighborY)) {
+                        continue;
+                    }
+                }
+
+                const i32 neighborTileIndex = MapTilePosToIndex(map, neighborX, neighborY);
+                const i32 neighborCost = tileCost + neighborCosts[neighborIndex];
+                if (neighborCost < flowField->integration[neighborTileIndex]) {
+                    flowField->integration[neighborTileIndex] = neighborCost;
+                    if (!inFrontier[neighborTileIndex]) {
+                        inFrontier[neighborTileIndex] = true;
+                        frontier.Enqueue(neighborTileIndex);
+                    }
+                }
+            }
+        }
+
+        // Direction field, each tile points at the center of its cheapest neighbor
+        for (i32 tileIndex = 0; tileIndex < tileCount; tileIndex++) {
+            if (tileIndex == destinationIndex || flowField->integration[tileIndex] == FlowField::UNREACHABLE) {
+                continue;
+            }
+
+            const i32 tileX = tileIndex % map->mapWidth;
+            const i32 tileY = tileIndex / map->mapWidth;
+
+            i32 bestCost = flowField->integration[tileIndex];
+            i32 bestX = tileX;
+            i32 bestY = tileY;
+            for (i32 neighborIndex = 0; neighborIndex < 8; neighborIndex++) {
+                const i32 neighborX = tileX + neighborOffsetsX[neighborIndex];
+                const i32 neighborY = tileY + neighborOffsetsY[neighborIndex];
+                if (!MapIsTileWalkable(map, neighborX, neighborY)) {
+                    continue;
+                }
+
+                if (neighborOffsetsX[neighborIndex] != 0 && neighborOffsetsY[neighborIndex] != 0) {
+                    if (!MapIsTileWalkable(map, neighborX, tileY) || !MapIsTileWalkable(map, tileX, neighborY)) {
+                        continue;
+                    }
+                }
+
+                const i32 neighborCost = flowField->integration[MapTilePosToIndex(map, neighborX, neighborY)];
+                if (neighborCost < bestCost) {
+                    bestCost = neighborCost;
+                    bestX = neighborX;
+                    bestY = neighborY;
+                }
+            }
+
+            if (bestX != tileX || bestY != tileY) {
+                const glm::vec2 tileCenter = MapTilePosToWorldPos(map, glm::vec2(tileX + 0.5f, tileY + 0.5f));
+                const glm::vec2 bestCenter = MapTilePosToWorldPos(map, glm::vec2(bestX + 0.5f, bestY + 0.5f));
+                flowField->direction[tileIndex] = glm::normalize(bestCenter - tileCenter);
+            }
+        }
+    }
+
+    glm::vec2 LeEngine::MapSampleFlowField(Map* map, const FlowField* flowField, glm::vec2 worldPos) {
+        const glm::vec2 tilePos = MapWorldPosToTilePos(map, worldPos);
+        const i32 tileX = (i32)tilePos.x;
+        const i32 tileY = (i32)tilePos.y;
+        if (tileX < 0 || tileX >= map->mapWidth || tileY < 0 || tileY >= map->mapHeight) {
+            return glm::vec2(0.0f);
+        }
+
+        return flowField->direction[MapTilePosToIndex(map, tileX, tileY)];
+    }
+
+    bool LeEngine::MapFindPath(Map* map, glm::ivec2 startTilePos, glm::ivec2 goalTilePos, List<glm::ivec2>& outPath) {
+        // Maps that fit in a single cluster get nothing from the hierarchy
+        if (map->pathHierarchy.GetClusterCount() > 1) {
+            return map->pathHierarchy.FindPath(startTilePos, goalTilePos, outPath);
+        }
+
+        return pathSearch.FindPath(map->pathGrid, startTilePos, goalTilePos, outPath);
+    }
+
+    bool LeEngine::MapRequestUnitPath(Map* map, i32 unitIndex, glm::vec2 goalWorldPos) {
+        MapReleaseUnitPath(map, unitIndex);
+
+        const glm::vec2 startTilePos = MapWorldPosToTilePos(map, map->units.pos[unitIndex]);
+        const glm::vec2 goalTilePos = MapWorldPosToTilePos(map, goalWorldPos);
+        const PathRequestHandle handle = map->pathRequests.Submit(glm::ivec2(startTilePos), glm::ivec2(goalTilePos));
+        map->units.pathRequest[unitIndex] = handle;
+
+        return handle.index != -1;
+    }
+
+    bool LeEngine::MapPollUnitPathRequest(Map* map, i32 unitIndex) {
+        const PathRequestHandle handle = map->units.pathRequest[unitIndex];
+        if (handle.index == -1) {
+            return false;
+        }
+
+        const PathRequestStatus status = map->pathRequests.GetStatus(handle);
+        if (status == PATH_REQUEST_STATUS_PENDING) {
+            return true;
+        }
+
+        if (status == PATH_REQUEST_STATUS_FOUND) {
+            for (i32 pathIndex = 0; pathIndex < Map::UNIT_PATH_CAPCITY; pathIndex++) {
+                UnitPath& path = map->unitPaths[pathIndex];
+                if (!path.inUse) {
+                    path.inUse = true;
+                    path.nextWaypoint = 0;
+                    path.waypoints.SetNum(0, false);
+
+                    // The first tile is the one the unit was standing on when the path was requested
+                    const List<glm::ivec2>& tiles = map->pathRequests.GetPath(handle);
+                    const i32 tileCount = tiles.GetNum();
+                    for (i32 tileIndex = 1; tileIndex < tileCount; tileIndex++) {
+                        const glm::vec2 tileCenter = glm::vec2(tiles[tileIndex]) + glm::vec2(0.5f);
+                        path.waypoints.Add(MapTilePosToWorldPos(map, tileCenter));
+                    }
+
+                    map->units.pathIndex[unitIndex] = pathIndex;
+                    break;
+                }
+            }
+        }
+
+        map->pathRequests.Release(handle);
+        map->units.pathRequest[unitIndex].index = -1;
+
+        return false;
+    }
+
+    void LeEngine::MapServicePathRequests(Map* map, f64 budgetMicroseconds) {
+        if (map->pathRequests.GetPendingCount() == 0) {
+            return;
+        }
+
+        map->pathRequests.Service(budgetMicroseconds, [&](glm::ivec2 start, glm::ivec2 goal, List<glm::ivec2>& outPath) {
+            return MapFindPath(map, start, goal, outPath);
+        });
+    }
+
+    glm::vec2 LeEngine::MapFollowUnitPath(Map* map, i32 unitIndex) {
+        const i32 pathIndex = map->units.pathIndex[unitIndex];
+        if (pathIndex == -1) {
+            return glm::vec2(0.0f);
+        }
+
+        UnitPath& path = map->unitPaths[pathIndex];
+        const glm::vec2 unitPos = map->units.pos[unitIndex];
+
+        // Close enough to a tile center counts as reached, units get pushed around too much to hit it exactly
+        const f32 reachedDistance = (f32)map->tileHalfHeight * 0.5f;
+        while (path.nextWaypoint < path.waypoints.GetNum() &&
+            glm::distance2(unitPos, path.waypoints[path.nextWaypoint]) < reachedDistance * reachedDistance) {
+            path.nextWaypoint++;
+        }
+
+        if (path.nextWaypoint == path.waypoints.GetNum()) {
+            MapReleaseUnitPath(map, unitIndex);
+            return glm::vec2(0.0f);
+        }
+
+        return glm::normalize(path.waypoints[path.nextWaypoint] - unitPos);
+    }
+
+    void LeEngine::MapReleaseUnitPath(Map* map, i32 unitIndex) {
+        if (map->units.pathRequest[unitIndex].index != -1) {
+            map->pathRequests.Release(map->units.pathRequest[unitIndex]);
+            map->units.pathRequest[unitIndex].index = -1;
+        }
+
+        const i32 pathIndex = map->units.pathIndex[unitIndex];
+        if (pathIndex != -1) {
+            map->unitPaths[pathIndex].inUse = false;
+            map->units.pathIndex[unitIndex] = -1;
+        }
+    }
+
+    const void* LeEngine::LoadEngineAsset(AssetId id, AssetType type) {
+        const i32 count = engineAssets.GetCount();
+        for (i32 assetIndex = 0; assetIndex < count; ++assetIndex) {
+            EngineAsset& asset = engineAssets[assetIndex];
+
+            if (!asset.id.IsValid()) {
+                break;
+            }
+
+            if (asset.id == id && asset.type == type) {
+                switch (asset.type) {
+                case ASSET_TYPE_TEXTURE: {
+                    if (asset.texture.textureHandle != 0) {
+                        return &asset.texture;
+                    }
+
+                    if (LoadTextureAsset(asset.path.GetCStr(), asset.texture)) {
+                        ATTOTRACE("Loaded texture asset %s", asset.path.GetCStr());
+                        return &asset.texture;
+                    }
+                } break;
+
+                case ASSET_TYPE_AUDIO: {
+                    if (asset.audio.bufferHandle != 0) {
+                        return &asset.audio;
+                    }
+
+                    if (LoadAudioAsset(asset.path.GetCStr(), asset.audio)) {
+                        ATTOTRACE("Loaded audio sasset %s", asset.path.GetCStr());
+                        return &asset.audio;
+                    }
+                } break;
+
+                case ASSET_TYPE_FONT: {
+                    if (asset.font.textureHandle != 0) {
+                        return &asset.font;
+                    }
+
+                    if (LoadFontAsset(asset.path.GetCStr(), asset.font)) {
+                        ATTOTRACE("Loaded font asset %s", asset.path.GetCStr());
+                        return &asset.font;
+                    }
+                } break;
+
+                default: {
+                    Assert(0, "");
+                }
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    PolygonCollider LeEngine::BlockerGetCollider(const Entity& entity) {
+        PolygonCollider collider = entity.tile.collider;
+        collider.Translate(entity.pos);
+
+        return collider;
+    }
+
+    TextureAsset* LeEngine::LoadTextureAsset(TextureAssetId id) {
+        return (TextureAsset*)LoadEngineAsset(id.ToRawId(), ASSET_TYPE_TEXTURE);
+    }
+
+    FontAsset* LeEngine::LoadFontAsset(FontAssetId id) {
+        return (FontAsset*)LoadEngineAsset(id.ToRawId(), ASSET_TYPE_FONT);
+    }
+
+    AudioAsset* LeEngine::LoadAudioAsset(AudioAssetId id) {
         return (AudioAsset*)LoadEngineAsset(id.ToRawId(), ASSET_TYPE_AUDIO);
     }
 
@@ -1189,80 +1859,322 @@ namespace atto {
     void LeEngine::ShaderProgramBind(ShaderProgram* program) {
         Assert(program->programHandle != 0, "Shader program not created");
         globalRenderingState.program = program;
-        glUseProgram(program->programHandle);
+        RenderStateBindProgram(program->programHandle);
     }
 
-    i32 LeEngine::ShaderProgramGetUniformLocation(const char* name) {
-        ShaderProgram* program = globalRenderingState.program;
-        if (program == nullptr) {
-            ATTOERROR("Shader progam in not bound");
-            return -1;
-        }
-
-        if (program->programHandle == 0) {
-            ATTOERROR("Shader progam in not valid");
-            return -1;
-        }
+    ShaderUniformHandle LeEngine::ShaderProgramGetUniform(ShaderProgram* program, const char* name) {
+        ShaderUniformHandle handle = {};
+        handle.programHandle = program->programHandle;
+        handle.location = -1;
 
-        const u32 uniformCount = program->uniforms.GetCount();
-        for (u32 uniformIndex = 0; uniformIndex < uniformCount; uniformIndex++) {
+        const i32 uniformCount = program->uniforms.GetCount();
+        for (i32 uniformIndex = 0; uniformIndex < uniformCount; uniformIndex++) {
             ShaderUniform& uniform = program->uniforms[uniformIndex];
             if (uniform.name == name) {
-                return uniform.location;
+                handle.location = uniform.location;
+                handle.type = uniform.type;
+                return handle;
             }
         }
 
-        i32 location = glGetUniformLocation(program->programHandle, name);
-        if (location >= 0) {
-            ShaderUniform newUniform = {};
-            newUniform.location = location;
-            newUniform.name = name;
+        ATTOERROR("Could not find uniform value %s", name);
+
+        return handle;
+    }
+
+    // Handles of uniforms the compiler stripped out are -1, setting them does nothing like it would with GL
+    static bool ShaderUniformCanSet(const GlobalRenderingState& globalRenderingState, ShaderUniformHandle uniform, u32 type) {
+        Assert(globalRenderingState.program != nullptr && globalRenderingState.program->programHandle == uniform.programHandle, "Shader uniform is not from the bound program");
+        Assert(uniform.location < 0 || uniform.type == type, "Shader uniform type mismatch");
+        return uniform.location >= 0;
+    }
+
+    void LeEngine::ShaderProgramSetInt(ShaderUniformHandle uniform, i32 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_INT)) {
+            glUniform1i(uniform.location, value);
+        }
+    }
+
+    void LeEngine::ShaderProgramSetSampler(ShaderUniformHandle uniform, i32 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_SAMPLER_2D)) {
+            glUniform1i(uniform.location, value);
+        }
+    }
+
+    void LeEngine::ShaderProgramSetTexture(i32 location, u32 textureHandle) {
+        RenderStateBindTexture(0, textureHandle);
+    }
 
-            program->uniforms.Add(newUniform);
+    void LeEngine::ShaderProgramSetFloat(ShaderUniformHandle uniform, f32 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_FLOAT)) {
+            glUniform1f(uniform.location, value);
         }
-        else {
-            ATTOERROR("Could not find uniform value %s", name);
+    }
+
+    void LeEngine::ShaderProgramSetVec2(ShaderUniformHandle uniform, glm::vec2 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_FLOAT_VEC2)) {
+            glUniform2fv(uniform.location, 1, glm::value_ptr(value));
         }
+    }
 
-        return location;
+    void LeEngine::ShaderProgramSetVec3(ShaderUniformHandle uniform, glm::vec3 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_FLOAT_VEC3)) {
+            glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+        }
     }
 
-    void LeEngine::ShaderProgramSetInt(const char* name, i32 value) {
-        i32 location = ShaderProgramGetUniformLocation(name);
-        if (location >= 0) {
-            glUniform1i(location, value);
+    void LeEngine::ShaderProgramSetVec4(ShaderUniformHandle uniform, glm::vec4 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_FLOAT_VEC4)) {
+            glUniform4fv(uniform.location, 1, glm::value_ptr(value));
         }
     }
 
-    void LeEngine::ShaderProgramSetSampler(const char* name, i32 value) {
-        i32 location = ShaderProgramGetUniformLocation(name);
-        if (location >= 0) {
-            glUniform1i(location, value);
+    void LeEngine::ShaderProgramSetMat3(ShaderUniformHandle uniform, glm::mat3 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_FLOAT_MAT3)) {
+            glUniformMatrix3fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
         }
     }
 
-    void LeEngine::ShaderProgramSetTexture(i32 location, u32 textureHandle) {
-        glBindTextureUnit(0, textureHandle);
+    void LeEngine::ShaderProgramSetMat4(ShaderUniformHandle uniform, glm::mat4 value) {
+        if (ShaderUniformCanSet(globalRenderingState, uniform, GL_FLOAT_MAT4)) {
+            glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void LeEngine::RenderStateInvalidate() {
+        globalRenderingState.boundProgram = GlobalRenderingState::UNKNOWN_BINDING;
+        globalRenderingState.boundVertexArray = GlobalRenderingState::UNKNOWN_BINDING;
+        globalRenderingState.boundArrayBuffer = GlobalRenderingState::UNKNOWN_BINDING;
+        for (i32 unit = 0; unit < GlobalRenderingState::TEXTURE_UNIT_COUNT; unit++) {
+            globalRenderingState.boundTextures[unit] = GlobalRenderingState::UNKNOWN_BINDING;
+        }
+        globalRenderingState.blendEnabled = GlobalRenderingState::UNKNOWN_BINDING;
+        globalRenderingState.blendSrcFactor = GlobalRenderingState::UNKNOWN_BINDING;
+        globalRenderingState.blendDstFactor = GlobalRenderingState::UNKNOWN_BINDING;
     }
 
-    void LeEngine::ShaderProgramSetVec4(const char* name, glm::vec4 value) {
-        i32 location = ShaderProgramGetUniformLocation(name);
-        if (location >= 0) {
-            glUniform4fv(location, 1, glm::value_ptr(value));
+    void LeEngine::RenderStateBindProgram(u32 programHandle) {
+        if (globalRenderingState.boundProgram == programHandle) {
+            renderingStats.stateChangeSkippedCount++;
+            return;
         }
+
+        glUseProgram(programHandle);
+        globalRenderingState.boundProgram = programHandle;
+        renderingStats.stateChangeCount++;
     }
 
-    void LeEngine::ShaderProgramSetMat4(const char* name, glm::mat4 value) {
-        i32 location = ShaderProgramGetUniformLocation(name);
-        if (location >= 0) {
-            glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    void LeEngine::RenderStateBindVertexArray(u32 vertexArray) {
+        if (globalRenderingState.boundVertexArray == vertexArray) {
+            renderingStats.stateChangeSkippedCount++;
+            return;
         }
+
+        glBindVertexArray(vertexArray);
+        globalRenderingState.boundVertexArray = vertexArray;
+        renderingStats.stateChangeCount++;
+    }
+
+    void LeEngine::RenderStateBindArrayBuffer(u32 buffer) {
+        if (globalRenderingState.boundArrayBuffer == buffer) {
+            renderingStats.stateChangeSkippedCount++;
+            return;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        globalRenderingState.boundArrayBuffer = buffer;
+        renderingStats.stateChangeCount++;
+    }
+
+    void LeEngine::RenderStateBindTexture(i32 unit, u32 textureHandle) {
+        Assert(unit >= 0 && unit < GlobalRenderingState::TEXTURE_UNIT_COUNT, "RenderStateBindTexture, invalid texture unit");
+        if (globalRenderingState.boundTextures[unit] == textureHandle) {
+            renderingStats.stateChangeSkippedCount++;
+            return;
+        }
+
+        glBindTextureUnit(unit, textureHandle);
+        globalRenderingState.boundTextures[unit] = textureHandle;
+        renderingStats.stateChangeCount++;
+    }
+
+    void LeEngine::RenderStateSetBlend(bool enabled, u32 srcFactor, u32 dstFactor) {
+        if (globalRenderingState.blendEnabled == (u32)enabled &&
+            globalRenderingState.blendSrcFactor == srcFactor &&
+            globalRenderingState.blendDstFactor == dstFactor) {
+            renderingStats.stateChangeSkippedCount++;
+            return;
+        }
+
+        if (enabled) {
+            glEnable(GL_BLEND);
+        }
+        else {
+            glDisable(GL_BLEND);
+        }
+        glBlendFunc(srcFactor, dstFactor);
+
+        globalRenderingState.blendEnabled = (u32)enabled;
+        globalRenderingState.blendSrcFactor = srcFactor;
+        globalRenderingState.blendDstFactor = dstFactor;
+        renderingStats.stateChangeCount++;
+    }
+
+    void LeEngine::InitializeFrameUniforms() {
+        glCreateBuffers(1, &globalRenderingState.frameUniformBuffer);
+        glNamedBufferData(globalRenderingState.frameUniformBuffer, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+
+        glBindBufferBase(GL_UNIFORM_BUFFER, GlobalRenderingState::FRAME_UNIFORMS_BINDING, globalRenderingState.frameUniformBuffer);
+
+        ATTOTRACE("Completed frame uniforms initialization");
+    }
+
+    void LeEngine::DrawSubmitFrameUniforms() {
+        static_assert(sizeof(FrameUniforms) == 144, "Frame uniforms don't match the std140 block");
+
+        FrameUniforms frameUniforms = {};
+        frameUniforms.cameraViewProjection = cameraProjection * cameraView;
+        frameUniforms.screenProjection = screenProjection;
+        frameUniforms.surfaceSize = glm::vec4((f32)mainSurfaceWidth, (f32)mainSurfaceHeight, 1.0f / (f32)mainSurfaceWidth, 1.0f / (f32)mainSurfaceHeight);
+
+        glNamedBufferSubData(globalRenderingState.frameUniformBuffer, 0, sizeof(FrameUniforms), &frameUniforms);
     }
 
     void LeEngine::VertexBufferUpdate(VertexBuffer vertexBuffer, i32 offset, i32 size, const void* data) {
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer.vbo);
-        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glNamedBufferSubData(vertexBuffer.vbo, offset, size, data);
+    }
+
+    void LeEngine::VertexBufferFree(VertexBuffer* vertexBuffer) {
+        // GL unbinds deleted objects, and a new one could come back with the same name
+        if (globalRenderingState.boundVertexArray == vertexBuffer->vao) {
+            globalRenderingState.boundVertexArray = GlobalRenderingState::UNKNOWN_BINDING;
+        }
+        if (globalRenderingState.boundArrayBuffer == vertexBuffer->vbo) {
+            globalRenderingState.boundArrayBuffer = GlobalRenderingState::UNKNOWN_BINDING;
+        }
+
+        glDeleteVertexArrays(1, &vertexBuffer->vao);
+        glDeleteBuffers(1, &vertexBuffer->vbo);
+        *vertexBuffer = {};
+    }
+
+    void LeEngine::InitializeStreamingVertexBuffer() {
+        StreamingVertexBuffer& stream = streamingVertexBuffer;
+        stream = {};
+
+        i32 majorVersion = 0;
+        i32 minorVersion = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+        glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+        stream.persistent = majorVersion > 4 || (majorVersion == 4 && minorVersion >= 4);
+
+        const i32 sizeBytes = StreamingVertexBuffer::FRAME_COUNT * StreamingVertexBuffer::FRAME_SIZE_BYTES;
+
+        glGenBuffers(1, &stream.buffer);
+        RenderStateBindArrayBuffer(stream.buffer);
+
+        if (stream.persistent) {
+            const u32 flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, sizeBytes, nullptr, flags);
+            stream.persistentData = (byte*)glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeBytes, flags);
+            Assert(stream.persistentData != nullptr, "Could not map the streaming vertex buffer");
+        }
+        else {
+            glBufferData(GL_ARRAY_BUFFER, sizeBytes, nullptr, GL_STREAM_DRAW);
+        }
+
+        stream.end = sizeBytes;
+
+        ATTOTRACE("Completed streaming vertex buffer initialization (%s)", stream.persistent ? "persistent" : "orphaning");
+    }
+
+    void LeEngine::StreamingVertexBufferBeginFrame() {
+        StreamingVertexBuffer& stream = streamingVertexBuffer;
+        if (!stream.persistent) {
+            // The whole buffer is one ring, it's orphaned in Map when it runs out
+            return;
+        }
+
+        GLsync fence = (GLsync)stream.frameFences[stream.frameIndex];
+        if (fence != nullptr) {
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED) {
+                renderingStats.streamingWaitCount++;
+                while (result == GL_TIMEOUT_EXPIRED) {
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                }
+            }
+
+            glDeleteSync(fence);
+            stream.frameFences[stream.frameIndex] = nullptr;
+        }
+
+        stream.head = stream.frameIndex * StreamingVertexBuffer::FRAME_SIZE_BYTES;
+        stream.end = stream.head + StreamingVertexBuffer::FRAME_SIZE_BYTES;
+    }
+
+    void LeEngine::StreamingVertexBufferEndFrame() {
+        StreamingVertexBuffer& stream = streamingVertexBuffer;
+        Assert(!stream.mapped, "Streaming vertex buffer still mapped at the end of the frame");
+        if (!stream.persistent) {
+            return;
+        }
+
+        stream.frameFences[stream.frameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        stream.frameIndex = (stream.frameIndex + 1) % StreamingVertexBuffer::FRAME_COUNT;
+    }
+
+    void* LeEngine::StreamingVertexBufferMap(i32 sizeBytes, i32 stride, i32& outFirst) {
+        StreamingVertexBuffer& stream = streamingVertexBuffer;
+        Assert(!stream.mapped, "Streaming vertex buffer is already mapped");
+
+        i32 head = ((stream.head + stride - 1) / stride) * stride;
+        if (head + sizeBytes > stream.end) {
+            if (stream.persistent || sizeBytes > stream.end) {
+                ATTOERROR("Streaming vertex buffer is full, %d bytes dropped", sizeBytes);
+                return nullptr;
+            }
+
+            // Nothing written since the last orphan is overwritten, the driver hands back fresh storage instead
+            RenderStateBindArrayBuffer(stream.buffer);
+            glBufferData(GL_ARRAY_BUFFER, stream.end, nullptr, GL_STREAM_DRAW);
+            head = 0;
+        }
+
+        outFirst = head / stride;
+        stream.head = head + sizeBytes;
+        renderingStats.streamedBytes += sizeBytes;
+
+        if (stream.persistent) {
+            return stream.persistentData + head;
+        }
+
+        RenderStateBindArrayBuffer(stream.buffer);
+        void* data = glMapBufferRange(GL_ARRAY_BUFFER, head, sizeBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        stream.mapped = data != nullptr;
+
+        return data;
+    }
+
+    void LeEngine::StreamingVertexBufferUnmap() {
+        StreamingVertexBuffer& stream = streamingVertexBuffer;
+        if (stream.mapped) {
+            RenderStateBindArrayBuffer(stream.buffer);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            stream.mapped = false;
+        }
+    }
+
+    bool LeEngine::StreamingVertexBufferWrite(const void* data, i32 sizeBytes, i32 stride, i32& outFirst) {
+        void* dst = StreamingVertexBufferMap(sizeBytes, stride, outFirst);
+        if (dst == nullptr) {
+            return false;
+        }
+
+        std::memcpy(dst, data, sizeBytes);
+        StreamingVertexBufferUnmap();
+
+        return true;
     }
 
     void LeEngine::DrawSurfaceResized(i32 w, i32 h) {
@@ -1345,53 +2257,27 @@ namespace atto {
     }
 
     void LeEngine::DrawEnableAlphaBlending() {
-        glEnable(GL_BLEND);
-        //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        //RenderStateSetBlend(true, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        RenderStateSetBlend(true, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
         //glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
         //glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
     }
 
-    DrawShapeCommand LeEngine::DrawShapeCreateCommand() {
-        DrawShapeCommand cmd = {};
-        cmd.projection = screenProjection;
-        cmd.color = glm::vec4(1, 1, 1, 1);
-        return cmd;
+    static u16 PackUnorm16(f32 value) {
+        return (u16)(glm::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    }
+
+    static u32 PackColorRGBA8(glm::vec4 color) {
+        const glm::vec4 c = glm::clamp(color, glm::vec4(0.0f), glm::vec4(1.0f)) * 255.0f + 0.5f;
+        return (u32)c.r | ((u32)c.g << 8) | ((u32)c.b << 16) | ((u32)c.a << 24);
     }
 
     void LeEngine::DrawShapeRect(glm::vec2 bl, glm::vec2 tr, const glm::vec4& color) {
-        DrawShapeCommand cmd = DrawShapeCreateCommand();
-        cmd.type = DRAW_SHAPE_TYPE_RECT;
-        cmd.bl = bl;
-        cmd.br = glm::vec2(tr.x, bl.y);
-        cmd.tr = tr;
-        cmd.tl = glm::vec2(bl.x, tr.y);
-        cmd.color = color;
-        DrawShapeAddCommand(cmd);
+        DrawShapeAddInstance(DRAW_SHAPE_TYPE_RECT, (bl + tr) / 2.0f, glm::abs(tr - bl) / 2.0f, 0.0f, 0.0f, color);
     }
 
     void LeEngine::DrawShapeRectCenterDimRot(glm::vec2 center, glm::vec2 dim, f32 rot, const glm::vec4& color /*= glm::vec4(1, 1, 1, 1)*/) {
-        DrawShapeCommand cmd = DrawShapeCreateCommand();
-        cmd.type = DRAW_SHAPE_TYPE_RECT;
-        cmd.bl = -dim / 2.0f;
-        cmd.tr = dim / 2.0f;
-        cmd.br = glm::vec2(cmd.tr.x, cmd.bl.y);
-        cmd.tl = glm::vec2(cmd.bl.x, cmd.tr.y);
-
-        glm::mat2 rotationMatrix = glm::mat2(cos(rot), -sin(rot), sin(rot), cos(rot));
-        cmd.bl = rotationMatrix * cmd.bl;
-        cmd.tr = rotationMatrix * cmd.tr;
-        cmd.br = rotationMatrix * cmd.br;
-        cmd.tl = rotationMatrix * cmd.tl;
-
-        cmd.bl += center;
-        cmd.tr += center;
-        cmd.br += center;
-        cmd.tl += center;
-
-        cmd.color = color;
-
-        DrawShapeAddCommand(cmd);
+        DrawShapeAddInstance(DRAW_SHAPE_TYPE_RECT, center, dim / 2.0f, rot, 0.0f, color);
     }
 
     void LeEngine::DrawShapeRectCenterDim(glm::vec2 center, glm::vec2 dim) {
@@ -1401,222 +2287,521 @@ namespace atto {
     }
 
     void LeEngine::DrawShapeCircle(glm::vec2 center, f32 radius, const glm::vec4& color) {
-        DrawShapeCommand cmd = DrawShapeCreateCommand();
-        cmd.type = DRAW_SHAPE_TYPE_CIRCLE;
-        cmd.center = center;
-        cmd.radius = radius;
-        cmd.color = color;
-        DrawShapeAddCommand(cmd);
+        // The 2 here is to stop the circle from being cut of from the edges
+        DrawShapeAddInstance(DRAW_SHAPE_TYPE_CIRCLE, center, glm::vec2(radius), 0.0f, radius - 2.0f, color);
     }
 
     void LeEngine::DrawShapeRoundRect(glm::vec2 bl, glm::vec2 tr, f32 radius) {
-        DrawShapeCommand cmd = DrawShapeCreateCommand();
-        cmd.type = DRAW_SHAPE_TYPE_RECT_ROUND;
-        cmd.bl = bl;
-        cmd.tr = tr;
-        cmd.radius = radius;
-        DrawShapeAddCommand(cmd);
+        DrawShapeAddInstance(DRAW_SHAPE_TYPE_RECT_ROUND, (bl + tr) / 2.0f, glm::abs(tr - bl) / 2.0f, 0.0f, radius, glm::vec4(1, 1, 1, 1));
     }
 
-    void LeEngine::DrawShapePolygon(const PolygonCollider& polygon, const glm::vec4& color) {
-        DrawShapeCommand cmd = DrawShapeCreateCommand();
-        cmd.type = DRAW_SHAPE_TYPE_RECT_POLY;
+    void LeEngine::DrawShapePolygon(const PolygonCollider& polygon, const glm::vec4& color) {
+        glm::vec2 triangles[16] = {};
+        const i32 triangleVertexCount = Geometry::Triangulate(polygon, triangles, 16);
+
+        const u32 packedColor = PackColorRGBA8(color);
+        for (i32 vertexIndex = 0; vertexIndex < triangleVertexCount; vertexIndex++) {
+            ShapeVertex vertex = {};
+            vertex.position = triangles[vertexIndex];
+            vertex.color = packedColor;
+            shapeRenderingState.polygonVertices.Add(vertex);
+        }
+    }
+
+    void LeEngine::DrawShapePolygon(const glm::vec2* vertices, i32 vertexCount, const glm::vec4& color /*= glm::vec4(1, 1, 1, 1)*/) {
+        PolygonCollider p = {};
+        Assert(vertexCount < p.vertices.GetCapcity(), "Too many verts for draw polygon, need a better solution for this!");
+        for (i32 vertexIndex = 0; vertexIndex < vertexCount; vertexIndex++) {
+            p.vertices.Add(vertices[vertexIndex]);
+        }
+
+        DrawShapePolygon(p, color);
+    }
+
+    void LeEngine::DrawShapeAddInstance(ShapeType type, glm::vec2 center, glm::vec2 halfSize, f32 rotation, f32 radius, const glm::vec4& color) {
+        ShapeInstanceVertex instance = {};
+        instance.center = center;
+        instance.halfSize = halfSize;
+        instance.rotation = rotation;
+        instance.radius = radius;
+        instance.type = (f32)type;
+        instance.color = PackColorRGBA8(color);
+        shapeRenderingState.instances.Add(instance);
+    }
+
+    void LeEngine::DrawShapeClearCommands() {
+        shapeRenderingState.polygonVertices.Clear();
+        shapeRenderingState.instances.Clear();
+    }
+
+    void LeEngine::DrawShapeRender() {
+        static_assert(sizeof(ShapeInstanceVertex) == 32, "Shape instance size mismatch");
+
+        // Polygons first, they're the big debug overlays, then every other shape in one instanced draw in the order they were added
+        const i32 polygonVertexCount = shapeRenderingState.polygonVertices.GetCount();
+        i32 firstVertex = 0;
+        if (polygonVertexCount > 0 && StreamingVertexBufferWrite(shapeRenderingState.polygonVertices.GetData(), polygonVertexCount * sizeof(ShapeVertex), sizeof(ShapeVertex), firstVertex)) {
+            ShaderProgramBind(&shapeRenderingState.program);
+
+            RenderStateBindVertexArray(shapeRenderingState.vertexBuffer.vao);
+            glDrawArrays(GL_TRIANGLES, firstVertex, polygonVertexCount);
+            renderingStats.drawCallCount++;
+        }
+
+        const i32 instanceCount = shapeRenderingState.instances.GetCount();
+        i32 firstInstance = 0;
+        if (instanceCount > 0 && StreamingVertexBufferWrite(shapeRenderingState.instances.GetData(), instanceCount * sizeof(ShapeInstanceVertex), sizeof(ShapeInstanceVertex), firstInstance)) {
+            ShaderProgramBind(&shapeRenderingState.instancedProgram);
+
+            RenderStateBindVertexArray(shapeRenderingState.instanceBuffer.vao);
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, 6, instanceCount, firstInstance);
+            renderingStats.drawCallCount++;
+        }
+    }
+
+    DrawSpriteCommand LeEngine::DrawSpriteCreateCommand() {
+        DrawSpriteCommand cmd = {};
+        cmd.color = glm::vec4(1, 1, 1, 1);
+        return cmd;
+    }
+
+    void LeEngine::DrawSprite(SpriteAsset* sprite, glm::vec2 pos, f32 rotation, i32 frameIndex) {
+        DrawSprite(sprite, pos, rotation, frameIndex, SPRITE_LAYER_WORLD, pos);
+    }
+
+    void LeEngine::DrawSprite(SpriteAsset* spriteAsset, glm::vec2 pos, f32 rotation, i32 frameIndex, SpriteLayer layer, glm::vec2 depthPos) {
+        DrawSpriteCommand cmd = DrawSpriteCreateCommand();
+        cmd.spriteAsset = spriteAsset;
+        cmd.position = pos;
+        cmd.rotation = rotation;
+        cmd.frameIndex = frameIndex;
+        cmd.sortKey = DrawSpriteMakeSortKey(layer, depthPos, spriteAsset);
+        DrawSpriteAddCommand(cmd);
+    }
+
+    BoxBounds LeEngine::DrawSpriteGetBounds(const SpriteAsset* spriteAsset, glm::vec2 pos, f32 rotation) {
+        BoxBounds bounds = {};
+        if (rotation != 0.0f) {
+            bounds.CreateFromCenterSize(pos, glm::vec2(SpriteGetMaxExtent(spriteAsset) * 2.0f));
+            return bounds;
+        }
+
+        // Same origin rules as DrawSpriteBuildVertices
+        const glm::vec2 size = spriteAsset->frameSize;
+        bounds.min = pos;
+        if (spriteAsset->origin == SPRITE_ORIGIN_CENTER) {
+            bounds.min -= size / 2.0f;
+        }
+        else if (spriteAsset->origin == SPRITE_ORIGIN_BOTTOM_CENTER) {
+            bounds.min.x -= size.x / 2.0f;
+        }
+        bounds.max = bounds.min + size;
+
+        return bounds;
+    }
+
+    u64 LeEngine::DrawSpriteMakeSortKey(SpriteLayer layer, glm::vec2 depthPos, SpriteAsset* spriteAsset) {
+        // Further down the screen is nearer the camera. In tile units this is tileX + tileY, whole tiles go
+        // in the depth bits and the fraction in the sub-tile bits. Biased so negative depths still sort.
+        const i64 depthBias = 1 << 23;
+        const f32 depth = -depthPos.y / (f32)currentMap->tileHalfHeight;
+        const f32 wholeDepth = floorf(depth);
+        const u64 isometricDepth = (u64)glm::clamp((i64)wholeDepth + depthBias, (i64)0, depthBias * 2 - 1);
+        const u64 subTileDepth = (u64)((depth - wholeDepth) * 65535.0f);
+
+        // Sprites at the same depth group by texture so they land in the same batch
+        u64 textureKey = 0;
+        if (spriteAsset != nullptr && DrawSpriteLoadTexture(spriteAsset)) {
+            textureKey = spriteAsset->texture->textureHandle & 0xFFFF;
+        }
+
+        return ((u64)layer << 56) | (isometricDepth << 32) | (subTileDepth << 16) | textureKey;
+    }
+
+    void LeEngine::DrawSpriteAddCommand(const DrawSpriteCommand& cmd) {
+        spriteRenderingState.commands.Add(cmd);
+    }
+
+    void LeEngine::DrawSpriteClearCommands() {
+        spriteRenderingState.commands.Clear();
+    }
+
+    void LeEngine::DrawSpriteRender() {
+        const i32 commandCount = spriteRenderingState.commands.GetCount();
+        if (commandCount == 0) {
+            return;
+        }
+
+        DrawSpriteSortCommands(spriteRenderingState.commands.GetData(), commandCount, spriteRenderingState.sortedCommands);
+
+        const DrawSpriteCommand* commands = spriteRenderingState.sortedCommands.GetData();
+        List<SpriteBatch>& batches = spriteRenderingState.batches;
+
+        // Built straight into the streaming buffer, room is taken for every command since culled ones aren't known yet
+        if (spriteRenderingState.mode == SPRITE_RENDER_MODE_INSTANCED) {
+            i32 firstInstance = 0;
+            SpriteInstanceVertex* instances = (SpriteInstanceVertex*)StreamingVertexBufferMap(commandCount * sizeof(SpriteInstanceVertex), sizeof(SpriteInstanceVertex), firstInstance);
+            if (instances == nullptr) {
+                return;
+            }
+
+            const i32 instanceCount = DrawSpriteBuildInstances(commands, commandCount, instances, batches);
+            StreamingVertexBufferUnmap();
+            if (instanceCount == 0) {
+                return;
+            }
+
+            const i32 uploadBytes = instanceCount * sizeof(SpriteInstanceVertex);
+
+            ShaderProgramBind(&spriteRenderingState.instancedProgram);
+
+            RenderStateBindVertexArray(spriteRenderingState.instanceBuffer.vao);
+
+            const i32 batchCount = batches.GetNum();
+            for (i32 batchIndex = 0; batchIndex < batchCount; batchIndex++) {
+                const SpriteBatch& batch = batches[batchIndex];
+                ShaderProgramSetTexture(0, batch.textureHandle);
+                glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, SpriteRenderingState::VERTICES_PER_SPRITE, batch.count, firstInstance + batch.first);
+                renderingStats.drawCallCount++;
+            }
+
+            renderingStats.spriteCount += instanceCount;
+            renderingStats.spriteBatchCount += batchCount;
+            renderingStats.spriteUploadBytes += uploadBytes;
+        }
+        else {
+            i32 firstVertex = 0;
+            SpriteVertex* vertices = (SpriteVertex*)StreamingVertexBufferMap(commandCount * SpriteRenderingState::VERTICES_PER_SPRITE * sizeof(SpriteVertex), sizeof(SpriteVertex), firstVertex);
+            if (vertices == nullptr) {
+                return;
+            }
+
+            const i32 vertexCount = DrawSpriteBuildVertices(commands, commandCount, vertices, batches);
+            StreamingVertexBufferUnmap();
+            if (vertexCount == 0) {
+                return;
+            }
+
+            const i32 uploadBytes = vertexCount * sizeof(SpriteVertex);
+
+            ShaderProgramBind(&spriteRenderingState.program);
+
+            RenderStateBindVertexArray(spriteRenderingState.vertexBuffer.vao);
+
+            const i32 batchCount = batches.GetNum();
+            for (i32 batchIndex = 0; batchIndex < batchCount; batchIndex++) {
+                const SpriteBatch& batch = batches[batchIndex];
+                ShaderProgramSetTexture(0, batch.textureHandle);
+                ShaderProgramSetVec2(spriteRenderingState.batchOriginUniform, batch.origin);
+                glDrawArrays(GL_TRIANGLES, firstVertex + batch.first, batch.count);
+                renderingStats.drawCallCount++;
+            }
+
+            renderingStats.spriteCount += vertexCount / SpriteRenderingState::VERTICES_PER_SPRITE;
+            renderingStats.spriteBatchCount += batchCount;
+            renderingStats.spriteUploadBytes += uploadBytes;
+        }
+    }
+
+    void LeEngine::DrawGroundChunks(Map* map, const BoxBounds& visibleBounds) {
+        const i32 chunkCount = map->groundChunks.GetNum();
+        if (chunkCount == 0) {
+            return;
+        }
+
+        ShaderProgramBind(&spriteRenderingState.program);
+
+        // Diagonal by diagonal, so a chunk is drawn after the chunks above it that its tiles can overlap
+        const i32 diagonalCount = map->groundChunksWide + map->groundChunksHigh - 1;
+        for (i32 diagonal = 0; diagonal < diagonalCount; diagonal++) {
+            const i32 firstChunkX = glm::max(0, diagonal - (map->groundChunksHigh - 1));
+            const i32 lastChunkX = glm::min(diagonal, map->groundChunksWide - 1);
+            for (i32 chunkX = firstChunkX; chunkX <= lastChunkX; chunkX++) {
+                const i32 chunkY = diagonal - chunkX;
+                const GroundChunk& chunk = map->groundChunks[chunkY * map->groundChunksWide + chunkX];
+                if (chunk.vertexCount == 0) {
+                    continue;
+                }
+
+                if (!visibleBounds.Intersects(chunk.bounds)) {
+                    renderingStats.groundChunkCulledCount++;
+                    continue;
+                }
+
+                RenderStateBindVertexArray(chunk.vertexBuffer.vao);
+
+                const i32 batchCount = chunk.batches.GetNum();
+                for (i32 batchIndex = 0; batchIndex < batchCount; batchIndex++) {
+                    const SpriteBatch& batch = chunk.batches[batchIndex];
+                    ShaderProgramSetTexture(0, batch.textureHandle);
+                    ShaderProgramSetVec2(spriteRenderingState.batchOriginUniform, batch.origin);
+                    glDrawArrays(GL_TRIANGLES, batch.first, batch.count);
+                    renderingStats.drawCallCount++;
+                }
+
+                renderingStats.groundChunkCount++;
+                renderingStats.spriteCount += chunk.vertexCount / SpriteRenderingState::VERTICES_PER_SPRITE;
+                renderingStats.spriteBatchCount += batchCount;
+            }
+        }
+    }
+
+    void LeEngine::DrawSpriteSortCommands(const DrawSpriteCommand* commands, i32 commandCount, List<DrawSpriteCommand>& outSorted) {
+        List<u64>& keys = spriteRenderingState.sortKeys;
+        List<i32>& indices = spriteRenderingState.sortIndices;
+        keys.SetNum(commandCount, false);
+        indices.SetNum(commandCount, false);
+        spriteRenderingState.sortScratchKeys.SetNum(commandCount, false);
+        spriteRenderingState.sortScratchIndices.SetNum(commandCount, false);
+
+        // Sort the keys and indices, then move each command once
+        for (i32 commandIndex = 0; commandIndex < commandCount; commandIndex++) {
+            keys[commandIndex] = commands[commandIndex].sortKey;
+            indices[commandIndex] = commandIndex;
+        }
 
-        const i32 polyCount = Geometry::Triangulate(polygon, cmd.poly.GetData(), cmd.poly.GetCapcity());
-        cmd.poly.SetCount(polyCount);
+        Sorting::RadixSort64(keys.GetData(), indices.GetData(),
+            spriteRenderingState.sortScratchKeys.GetData(), spriteRenderingState.sortScratchIndices.GetData(), commandCount);
 
-        cmd.color = color;
-        DrawShapeAddCommand(cmd);
+        outSorted.SetNum(commandCount, false);
+        for (i32 sortedIndex = 0; sortedIndex < commandCount; sortedIndex++) {
+            outSorted[sortedIndex] = commands[indices[sortedIndex]];
+        }
     }
 
-    void LeEngine::DrawShapePolygon(const glm::vec2* vertices, i32 vertexCount, const glm::vec4& color /*= glm::vec4(1, 1, 1, 1)*/) {
-        PolygonCollider p = {};
-        Assert(vertexCount < p.vertices.GetCapcity(), "Too many verts for draw polygon, need a better solution for this!");
-        for (i32 vertexIndex = 0; vertexIndex < vertexCount; vertexIndex++) {
-            p.vertices.Add(vertices[vertexIndex]);
+    // Frames are frameSize cells inside the sprite's uv0/uv1 region, in rows of framesPerRow
+    static void SpriteBuildFrameUVs(SpriteAsset* spriteAsset) {
+        const TextureAsset* texture = spriteAsset->texture;
+        const glm::vec2 frameUVSize = spriteAsset->frameSize / glm::vec2((f32)texture->width, (f32)texture->height);
+        const i32 framesPerRow = glm::max(spriteAsset->framesPerRow, 1);
+        const i32 frameCount = glm::clamp(spriteAsset->frameCount, 1, SpriteAsset::FRAME_CAPCITY);
+
+        spriteAsset->frameUVs.Clear();
+        for (i32 frameIndex = 0; frameIndex < frameCount; frameIndex++) {
+            const glm::vec2 cell = glm::vec2((f32)(frameIndex % framesPerRow), (f32)(frameIndex / framesPerRow));
+            const glm::vec2 uv0 = spriteAsset->uv0 + cell * frameUVSize;
+            spriteAsset->frameUVs.Add(glm::vec4(uv0, uv0 + frameUVSize));
         }
 
-        DrawShapePolygon(p, color);
+        spriteAsset->animated = frameCount > 1 && spriteAsset->frameDuration > 0.0f;
     }
 
-    void LeEngine::DrawShapeAddCommand(const DrawShapeCommand& cmd) {
-        shapeRenderingState.commands.Add(cmd);
+    static glm::vec4 SpriteGetFrameUV(const SpriteAsset* spriteAsset, i32 frameIndex) {
+        return spriteAsset->frameUVs[glm::clamp(frameIndex, 0, spriteAsset->frameUVs.GetCount() - 1)];
     }
 
-    void LeEngine::DrawShapeClearCommands() {
-        shapeRenderingState.commands.Clear();
-    }
+    bool LeEngine::DrawSpriteLoadTexture(SpriteAsset* spriteAsset) {
+        Assert(spriteAsset != nullptr, "SPRITE: Sprite is null");
 
-    void LeEngine::DrawShapeRender() {
-        const i32 commandCount = shapeRenderingState.commands.GetCount();
-        for (i32 drawCommandIndex = 0; drawCommandIndex < commandCount; drawCommandIndex++) {
-            DrawShapeCommand& cmd = shapeRenderingState.commands[drawCommandIndex];
-            switch (cmd.type)
-            {
-            case DRAW_SHAPE_TYPE_RECT:
-            {
-                f32 vertices[6][2] = {
-                    { cmd.tl.x, cmd.tl.y, },
-                    { cmd.bl.x, cmd.bl.y, },
-                    { cmd.br.x, cmd.br.y, },
-
-                    { cmd.tl.x, cmd.tl.y, },
-                    { cmd.br.x, cmd.br.y, },
-                    { cmd.tr.x, cmd.tr.y, }
-                };
-
-                ShaderProgramBind(&shapeRenderingState.program);
-                ShaderProgramSetMat4("p", cmd.projection);
-                ShaderProgramSetInt("mode", 0);
-                ShaderProgramSetVec4("color", cmd.color);
-
-                glBindVertexArray(shapeRenderingState.vertexBuffer.vao);
-                VertexBufferUpdate(shapeRenderingState.vertexBuffer, 0, sizeof(vertices), vertices);
-                glDrawArrays(GL_TRIANGLES, 0, 6);
-                glBindVertexArray(0);
-            } break;
-            case DRAW_SHAPE_TYPE_CIRCLE:
-            {
-                f32 x1 = cmd.center.x - cmd.radius;
-                f32 y1 = cmd.center.y - cmd.radius;
-                f32 x2 = cmd.center.x + cmd.radius;
-                f32 y2 = cmd.center.y + cmd.radius;
-
-                f32 vertices[6][2] = {
-                    { x1, y2 },
-                    { x1, y1 },
-                    { x2, y1 },
-                    { x1, y2 },
-                    { x2, y1 },
-                    { x2, y2 }
-                };
-
-                ShaderProgramBind(&shapeRenderingState.program);
-                ShaderProgramSetMat4("p", cmd.projection);
-                ShaderProgramSetInt("mode", 1);
-                ShaderProgramSetVec4("color", cmd.color);
-                ShaderProgramSetVec4("shapePosAndSize", glm::vec4(cmd.center.x, (f32)mainSurfaceHeight - cmd.center.y, cmd.radius, cmd.radius));
-                ShaderProgramSetVec4("shapeRadius", glm::vec4(cmd.radius - 2, 0, 0, 0)); // The 4 here is to stop the circle from being cut of from the edges
-
-                glBindVertexArray(shapeRenderingState.vertexBuffer.vao);
-                VertexBufferUpdate(shapeRenderingState.vertexBuffer, 0, sizeof(vertices), vertices);
-                glDrawArrays(GL_TRIANGLES, 0, 6);
-                glBindVertexArray(0);
-            } break;
-            case DRAW_SHAPE_TYPE_RECT_ROUND:
-            {
-                f32 xpos = cmd.bl.x;
-                f32 ypos = cmd.bl.y;
-                f32 h = cmd.tr.y - cmd.bl.y;
-                f32 w = cmd.tr.x - cmd.bl.x;
-
-                f32 vertices[6][2] = {
-                    { xpos,     ypos + h, },
-                    { xpos,     ypos,     },
-                    { xpos + w, ypos,     },
-
-                    { xpos,     ypos + h, },
-                    { xpos + w, ypos,     },
-                    { xpos + w, ypos + h, }
-                };
-
-                f32 centerX = (cmd.bl.x + cmd.tr.x) / 2.0f;
-                f32 centerY = (cmd.bl.y + cmd.tr.y) / 2.0f;
-
-                ShaderProgramBind(&shapeRenderingState.program);
-                ShaderProgramSetMat4("p", cmd.projection);
-                ShaderProgramSetInt("mode", 2);
-                ShaderProgramSetVec4("color", cmd.color);
-                ShaderProgramSetVec4("shapePosAndSize", glm::vec4(centerX, centerY, w, h));
-                ShaderProgramSetVec4("shapeRadius", glm::vec4(cmd.radius, 0, 0, 0));
-
-                glBindVertexArray(shapeRenderingState.vertexBuffer.vao);
-                VertexBufferUpdate(shapeRenderingState.vertexBuffer, 0, sizeof(vertices), vertices);
-                glDrawArrays(GL_TRIANGLES, 0, 6);
-                glBindVertexArray(0);
-            } break;
-            case DRAW_SHAPE_TYPE_RECT_POLY:
-            {
-                const f32* vertices = (f32*)cmd.poly.GetData();
-                const i32 vertexCount = cmd.poly.GetCount();
-                const i32 vertexSize = cmd.poly.GetCount() * sizeof(glm::vec2);
-
-                ShaderProgramBind(&shapeRenderingState.program);
-                ShaderProgramSetMat4("p", cmd.projection);
-                ShaderProgramSetInt("mode", 0);
-                ShaderProgramSetVec4("color", cmd.color);
-
-                glBindVertexArray(shapeRenderingState.vertexBuffer.vao);
-                VertexBufferUpdate(shapeRenderingState.vertexBuffer, 0, vertexSize, vertices);
-                glDrawArrays(GL_TRIANGLES, 0, vertexCount);
-                glBindVertexArray(0);
-            } break;
-            default:
-                break;
+        if (spriteAsset->texture == nullptr) {
+            spriteAsset->texture = LoadTextureAsset(spriteAsset->textureId);
+            if (spriteAsset->texture == nullptr) {
+                ATTOERROR("SPRITE: Could not load texture asset");
+                return false;
             }
         }
+
+        if (spriteAsset->frameUVs.GetCount() == 0) {
+            SpriteBuildFrameUVs(spriteAsset);
+        }
+
+        return true;
     }
 
-    DrawSpriteCommand LeEngine::DrawSpriteCreateCommand() {
-        DrawSpriteCommand cmd = {};
-        cmd.color = glm::vec4(1, 1, 1, 1);
-        return cmd;
+    void SpriteQuadStreams::SetCount(i32 count) {
+        positionX.SetNum(count, false);
+        positionY.SetNum(count, false);
+        rotation.SetNum(count, false);
+        width.SetNum(count, false);
+        height.SetNum(count, false);
+        originX.SetNum(count, false);
+        originY.SetNum(count, false);
+        u0.SetNum(count, false);
+        v0.SetNum(count, false);
+        u1.SetNum(count, false);
+        v1.SetNum(count, false);
     }
 
-    void LeEngine::DrawSprite(SpriteAsset* sprite, glm::vec2 pos, f32 rotation, i32 frameIndex) {
-        DrawSprite(sprite, pos, rotation, frameIndex, glm::vec2(-1, -1));
+    // Farthest a batched sprite's corners can be from its batch origin
+    static const f32 SPRITE_VERTEX_POSITION_RANGE = 32767.0f / SpriteVertex::POSITION_SCALE;
+
+    static SpriteVertex SpriteMakeVertex(glm::vec2 position, f32 u, f32 v, u32 color) {
+        const glm::vec2 fixedPosition = glm::clamp(glm::round(position * (f32)SpriteVertex::POSITION_SCALE), glm::vec2(-32768.0f), glm::vec2(32767.0f));
+
+        SpriteVertex vertex = {};
+        vertex.position[0] = (i16)fixedPosition.x;
+        vertex.position[1] = (i16)fixedPosition.y;
+        vertex.uv[0] = PackUnorm16(u);
+        vertex.uv[1] = PackUnorm16(v);
+        vertex.color = color;
+        return vertex;
     }
 
-    void LeEngine::DrawSprite(SpriteAsset* spriteAsset, glm::vec2 pos, f32 rotation, i32 frameIndex, glm::vec2 tilePos) {
-        DrawSpriteCommand cmd = DrawSpriteCreateCommand();
-        cmd.spriteAsset = spriteAsset;
-        cmd.position = pos;
-        cmd.rotation = rotation;
-        cmd.frameIndex = frameIndex;
-        cmd.tilePos = tilePos;
-        cmd.tileIndex = MapTilePosToIndex(currentMap, tilePos);
-        DrawSpriteAddCommand(cmd);
+    void SpriteQuadKernel::ExpandScalar(const SpriteQuadStreams& streams, i32 first, i32 count, u32 color, SpriteVertex* outVertices) {
+        SpriteVertex* quad = outVertices + first * SpriteRenderingState::VERTICES_PER_SPRITE;
+        for (i32 spriteIndex = first; spriteIndex < first + count; spriteIndex++, quad += SpriteRenderingState::VERTICES_PER_SPRITE) {
+            const f32 x0 = streams.originX[spriteIndex];
+            const f32 y0 = streams.originY[spriteIndex];
+            const f32 x1 = x0 + streams.width[spriteIndex];
+            const f32 y1 = y0 + streams.height[spriteIndex];
+            const glm::vec2 position = glm::vec2(streams.positionX[spriteIndex], streams.positionY[spriteIndex]);
+
+            glm::vec2 vertex1 = glm::vec2(x0, y1);
+            glm::vec2 vertex2 = glm::vec2(x0, y0);
+            glm::vec2 vertex3 = glm::vec2(x1, y0);
+            glm::vec2 vertex4 = glm::vec2(x1, y1);
+
+            const f32 rotation = streams.rotation[spriteIndex];
+            if (rotation != 0.0f) {
+                const glm::mat2 rotationMatrix = glm::mat2(cosf(rotation), -sinf(rotation), sinf(rotation), cosf(rotation));
+                vertex1 = rotationMatrix * vertex1;
+                vertex2 = rotationMatrix * vertex2;
+                vertex3 = rotationMatrix * vertex3;
+                vertex4 = rotationMatrix * vertex4;
+            }
+
+            const f32 u0 = streams.u0[spriteIndex];
+            const f32 v0 = streams.v0[spriteIndex];
+            const f32 u1 = streams.u1[spriteIndex];
+            const f32 v1 = streams.v1[spriteIndex];
+
+            quad[0] = SpriteMakeVertex(vertex1 + position, u0, v0, color);
+            quad[1] = SpriteMakeVertex(vertex2 + position, u0, v1, color);
+            quad[2] = SpriteMakeVertex(vertex3 + position, u1, v1, color);
+            quad[3] = quad[0];
+            quad[4] = quad[2];
+            quad[5] = SpriteMakeVertex(vertex4 + position, u1, v0, color);
+        }
     }
 
-    void LeEngine::DrawSpriteAddCommand(const DrawSpriteCommand& cmd) {
-        spriteRenderingState.commands.Add(cmd);
+#if ATTO_SIMD_SSE
+    // Four sprites worth of corners in SoA form (lane = sprite). Each corner is packed into x | y << 16 and
+    // u | v << 16 words for all four lanes at once, then the words are scattered into the six vertices
+    static void SpriteQuadWrite4(const __m128 x[4], const __m128 y[4], __m128 u0, __m128 v0, __m128 u1, __m128 v1, u32 color, SpriteVertex* outVertices) {
+        const __m128 positionScale = _mm_set1_ps((f32)SpriteVertex::POSITION_SCALE);
+        const __m128 uvScale = _mm_set1_ps(65535.0f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128i uvBias = _mm_set1_epi32(32768);
+        const __m128i uvSignFlip = _mm_set1_epi16((i16)0x8000);
+        const __m128 cornerU[4] = { u0, u0, u1, u1 };
+        const __m128 cornerV[4] = { v0, v1, v1, v0 };
+
+        alignas(16) u32 positions[4][4];    // Corner, lane
+        alignas(16) u32 uvs[4][4];
+        for (i32 cornerIndex = 0; cornerIndex < 4; cornerIndex++) {
+            // Rounds to nearest and saturates to i16 like SpriteMakeVertex clamps
+            const __m128i xy = _mm_packs_epi32(
+                _mm_cvtps_epi32(_mm_mul_ps(x[cornerIndex], positionScale)),
+                _mm_cvtps_epi32(_mm_mul_ps(y[cornerIndex], positionScale)));
+            _mm_store_si128((__m128i*)positions[cornerIndex], _mm_unpacklo_epi16(xy, _mm_srli_si128(xy, 8)));
+
+            // There's no unsigned saturating pack before SSE4.1, so the uvs are biased into the signed range
+            // for the pack and the bias is taken back off by flipping the sign bit
+            const __m128 u = _mm_min_ps(_mm_max_ps(cornerU[cornerIndex], zero), one);
+            const __m128 v = _mm_min_ps(_mm_max_ps(cornerV[cornerIndex], zero), one);
+            __m128i uv = _mm_packs_epi32(
+                _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(u, uvScale)), uvBias),
+                _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(v, uvScale)), uvBias));
+            uv = _mm_xor_si128(uv, uvSignFlip);
+            _mm_store_si128((__m128i*)uvs[cornerIndex], _mm_unpacklo_epi16(uv, _mm_srli_si128(uv, 8)));
+        }
+
+        static const i32 quadCorners[SpriteRenderingState::VERTICES_PER_SPRITE] = { 0, 1, 2, 0, 2, 3 };
+        SpriteVertex* vertex = outVertices;
+        for (i32 lane = 0; lane < 4; lane++) {
+            for (i32 vertexIndex = 0; vertexIndex < SpriteRenderingState::VERTICES_PER_SPRITE; vertexIndex++, vertex++) {
+                const i32 cornerIndex = quadCorners[vertexIndex];
+                std::memcpy(vertex->position, &positions[cornerIndex][lane], sizeof(u32));
+                std::memcpy(vertex->uv, &uvs[cornerIndex][lane], sizeof(u32));
+                vertex->color = color;
+            }
+        }
     }
 
-    void LeEngine::DrawSpriteClearCommands() {
-        spriteRenderingState.commands.Clear();
+    // Local corners are (x0, y1), (x0, y0), (x1, y0), (x1, y1), in the order of the vertices they become
+    static void SpriteQuadCorners4(__m128 px, __m128 py, __m128 x0, __m128 y0, __m128 x1, __m128 y1, __m128 c, __m128 s, bool rotated, __m128 outX[4], __m128 outY[4]) {
+        const __m128 localX[4] = { x0, x0, x1, x1 };
+        const __m128 localY[4] = { y1, y0, y0, y1 };
+        for (i32 cornerIndex = 0; cornerIndex < 4; cornerIndex++) {
+            if (rotated) {
+                // Same as the glm::mat2(c, -s, s, c) the scalar path uses
+                outX[cornerIndex] = _mm_add_ps(px, _mm_add_ps(_mm_mul_ps(c, localX[cornerIndex]), _mm_mul_ps(s, localY[cornerIndex])));
+                outY[cornerIndex] = _mm_add_ps(py, _mm_sub_ps(_mm_mul_ps(c, localY[cornerIndex]), _mm_mul_ps(s, localX[cornerIndex])));
+            }
+            else {
+                outX[cornerIndex] = _mm_add_ps(px, localX[cornerIndex]);
+                outY[cornerIndex] = _mm_add_ps(py, localY[cornerIndex]);
+            }
+        }
     }
+#endif
 
-    void LeEngine::DrawSpriteRender() {
-        const i32 commandCount = spriteRenderingState.commands.GetCount();
-        for (i32 commandIndex = 0; commandIndex < commandCount; commandIndex++) {
-            const DrawSpriteCommand& cmd = spriteRenderingState.commands[commandIndex];
-            Assert(cmd.spriteAsset != nullptr, "SPRITE: Sprite is null");
-
-            if (cmd.spriteAsset->texture == nullptr) {
-                cmd.spriteAsset->texture = LoadTextureAsset(cmd.spriteAsset->textureId);
-                if (cmd.spriteAsset->texture == nullptr) {
-                    ATTOERROR("SPRITE: Could not load texture asset");
-                    return;
+    void SpriteQuadKernel::Expand(const SpriteQuadStreams& streams, i32 count, u32 color, SpriteVertex* outVertices) {
+        i32 spriteIndex = 0;
+
+#if ATTO_SIMD_SSE
+        for (; spriteIndex + LANE_COUNT <= count; spriteIndex += LANE_COUNT) {
+            const __m128 rotation = _mm_loadu_ps(&streams.rotation[spriteIndex]);
+            const bool rotated = _mm_movemask_ps(_mm_cmpneq_ps(rotation, _mm_setzero_ps())) != 0;
+
+            // There's no vector sin/cos to lean on, so the rotated groups pay for them per lane
+            alignas(16) f32 sines[LANE_COUNT];
+            alignas(16) f32 cosines[LANE_COUNT];
+            if (rotated) {
+                for (i32 lane = 0; lane < LANE_COUNT; lane++) {
+                    const f32 r = streams.rotation[spriteIndex + lane];
+                    sines[lane] = r != 0.0f ? sinf(r) : 0.0f;
+                    cosines[lane] = r != 0.0f ? cosf(r) : 1.0f;
                 }
             }
 
-            ShaderProgramBind(&spriteRenderingState.program);
-            ShaderProgramSetMat4("p", cameraProjection * cameraView);
-            ShaderProgramSetSampler("texture0", 0);
-            ShaderProgramSetTexture(0, cmd.spriteAsset->texture->textureHandle);
+            const __m128 px = _mm_loadu_ps(&streams.positionX[spriteIndex]);
+            const __m128 py = _mm_loadu_ps(&streams.positionY[spriteIndex]);
+            const __m128 x0 = _mm_loadu_ps(&streams.originX[spriteIndex]);
+            const __m128 y0 = _mm_loadu_ps(&streams.originY[spriteIndex]);
+            const __m128 x1 = _mm_add_ps(x0, _mm_loadu_ps(&streams.width[spriteIndex]));
+            const __m128 y1 = _mm_add_ps(y0, _mm_loadu_ps(&streams.height[spriteIndex]));
+            const __m128 c = rotated ? _mm_load_ps(cosines) : _mm_set1_ps(1.0f);
+            const __m128 s = rotated ? _mm_load_ps(sines) : _mm_setzero_ps();
+
+            __m128 cornerX[4];
+            __m128 cornerY[4];
+            SpriteQuadCorners4(px, py, x0, y0, x1, y1, c, s, rotated, cornerX, cornerY);
+
+            SpriteQuadWrite4(cornerX, cornerY,
+                _mm_loadu_ps(&streams.u0[spriteIndex]), _mm_loadu_ps(&streams.v0[spriteIndex]),
+                _mm_loadu_ps(&streams.u1[spriteIndex]), _mm_loadu_ps(&streams.v1[spriteIndex]),
+                color, outVertices + spriteIndex * SpriteRenderingState::VERTICES_PER_SPRITE);
+        }
+#endif
 
-            f32 xpos = 0.0f;
-            f32 ypos = 0.0f;
+        ExpandScalar(streams, spriteIndex, count - spriteIndex, color, outVertices);
+    }
+
+    i32 LeEngine::DrawSpriteBuildVertices(const DrawSpriteCommand* commands, i32 commandCount, SpriteVertex* outVertices, List<SpriteBatch>& outBatches) {
+        static_assert(sizeof(SpriteVertex) == 12, "Sprite vertex size mismatch");
+
+        // Gather every command into the kernel's streams, a new batch only starts when the texture changes or
+        // a sprite would reach past what the fixed point positions can hold from the batch origin. The kernel
+        // then expands them all into one vertex stream in the same order.
+        outBatches.SetNum(0, false);
 
-            f32 scaleX = 1;
-            f32 scaleY = 1;
+        SpriteQuadStreams& streams = spriteRenderingState.quadStreams;
+        streams.SetCount(commandCount);
 
-            //sprite->frameSize.y = (f32)sprite->texture->height;
-            //sprite->frameSize.x = (f32)sprite->texture->width;
+        i32 spriteCount = 0;
+        for (i32 commandIndex = 0; commandIndex < commandCount; commandIndex++) {
+            const DrawSpriteCommand& cmd = commands[commandIndex];
+            if (!DrawSpriteLoadTexture(cmd.spriteAsset)) {
+                continue;
+            }
 
-            f32 w = cmd.spriteAsset->frameSize.x * scaleX;
-            f32 h = cmd.spriteAsset->frameSize.y * scaleY;
+            const f32 w = cmd.spriteAsset->frameSize.x;
+            const f32 h = cmd.spriteAsset->frameSize.y;
 
+            f32 xpos = 0.0f;
+            f32 ypos = 0.0f;
             if (cmd.spriteAsset->origin == SPRITE_ORIGIN_CENTER) {
                 xpos -= w / 2.0f;
                 ypos -= h / 2.0f;
@@ -1625,43 +2810,99 @@ namespace atto {
                 xpos -= w / 2.0f;
             }
 
-            f32 rotation = cmd.rotation;
-            glm::mat2 rotationMatrix = glm::mat2(cos(rotation), -sin(rotation), sin(rotation), cos(rotation));
-            glm::vec2 vertex1 = rotationMatrix * glm::vec2(xpos, ypos + h);
-            glm::vec2 vertex2 = rotationMatrix * glm::vec2(xpos, ypos);
-            glm::vec2 vertex3 = rotationMatrix * glm::vec2(xpos + w, ypos);
-            glm::vec2 vertex4 = rotationMatrix * glm::vec2(xpos + w, ypos + h);
+            const glm::vec4 frameUV = SpriteGetFrameUV(cmd.spriteAsset, cmd.frameIndex);
+
+            const u32 textureHandle = cmd.spriteAsset->texture->textureHandle;
+            const f32 reach = SpriteGetMaxExtent(cmd.spriteAsset);
+            bool startBatch = outBatches.GetNum() == 0 || outBatches[outBatches.GetNum() - 1].textureHandle != textureHandle;
+            if (!startBatch) {
+                const glm::vec2 fromOrigin = glm::abs(cmd.position - outBatches[outBatches.GetNum() - 1].origin) + reach;
+                startBatch = fromOrigin.x > SPRITE_VERTEX_POSITION_RANGE || fromOrigin.y > SPRITE_VERTEX_POSITION_RANGE;
+            }
+
+            if (startBatch) {
+                SpriteBatch batch = {};
+                batch.textureHandle = textureHandle;
+                batch.first = spriteCount * SpriteRenderingState::VERTICES_PER_SPRITE;
+                batch.origin = cmd.position;
+                outBatches.Add(batch);
+            }
+
+            SpriteBatch& batch = outBatches[outBatches.GetNum() - 1];
+            batch.count += SpriteRenderingState::VERTICES_PER_SPRITE;
+
+            streams.positionX[spriteCount] = cmd.position.x - batch.origin.x;
+            streams.positionY[spriteCount] = cmd.position.y - batch.origin.y;
+            streams.rotation[spriteCount] = cmd.rotation;
+            streams.width[spriteCount] = w;
+            streams.height[spriteCount] = h;
+            streams.originX[spriteCount] = xpos;
+            streams.originY[spriteCount] = ypos;
+            streams.u0[spriteCount] = frameUV.x;
+            streams.v0[spriteCount] = frameUV.y;
+            streams.u1[spriteCount] = frameUV.z;
+            streams.v1[spriteCount] = frameUV.w;
+
+            spriteCount++;
+        }
+
+        SpriteQuadKernel::Expand(streams, spriteCount, PackColorRGBA8(spriteRenderingState.color), outVertices);
 
-            vertex1 += cmd.position;
-            vertex2 += cmd.position;
-            vertex3 += cmd.position;
-            vertex4 += cmd.position;
+        return spriteCount * SpriteRenderingState::VERTICES_PER_SPRITE;
+    }
+
+    i32 LeEngine::DrawSpriteBuildInstances(const DrawSpriteCommand* commands, i32 commandCount, SpriteInstanceVertex* outInstances, List<SpriteBatch>& outBatches) {
+        static_assert(sizeof(SpriteInstanceVertex) == 32, "Sprite instance size mismatch");
 
-            glm::vec2 uv0 = cmd.spriteAsset->uv0;
-            glm::vec2 uv1 = cmd.spriteAsset->uv1;
+        outBatches.SetNum(0, false);
 
-            uv0.x = (cmd.frameIndex * cmd.spriteAsset->frameSize.x) / cmd.spriteAsset->texture->width;
-            uv1.x = (cmd.frameIndex * cmd.spriteAsset->frameSize.x + cmd.spriteAsset->frameSize.x) / cmd.spriteAsset->texture->width;
+        const u32 color = PackColorRGBA8(spriteRenderingState.color);
 
-            glm::vec4 color = spriteRenderingState.color;
+        i32 instanceCount = 0;
+        for (i32 commandIndex = 0; commandIndex < commandCount; commandIndex++) {
+            const DrawSpriteCommand& cmd = commands[commandIndex];
+            if (!DrawSpriteLoadTexture(cmd.spriteAsset)) {
+                continue;
+            }
 
-            f32 vertices[6][2 + 2 + 4] = {
-                { vertex1.x,  vertex1.y,    uv0.x, uv0.y,    color.r, color.g, color.b, color.a },
-                { vertex2.x,  vertex2.y,    uv0.x, uv1.y,    color.r, color.g, color.b, color.a },
-                { vertex3.x,  vertex3.y,    uv1.x, uv1.y,    color.r, color.g, color.b, color.a },
+            const SpriteAsset* spriteAsset = cmd.spriteAsset;
+            const glm::vec2 size = spriteAsset->frameSize;
 
-                { vertex1.x, vertex1.y,    uv0.x, uv0.y,    color.r, color.g, color.b, color.a },
-                { vertex3.x, vertex3.y,    uv1.x, uv1.y,    color.r, color.g, color.b, color.a },
-                { vertex4.x, vertex4.y,    uv1.x, uv0.y,    color.r, color.g, color.b, color.a }
-            };
+            glm::vec2 originOffset = glm::vec2(0.0f);
+            if (spriteAsset->origin == SPRITE_ORIGIN_CENTER) {
+                originOffset = -size / 2.0f;
+            }
+            else if (spriteAsset->origin == SPRITE_ORIGIN_BOTTOM_CENTER) {
+                originOffset.x = -size.x / 2.0f;
+            }
 
-            static_assert(sizeof(vertices) == sizeof(SpriteVertex) * 6, "Sprite vertex size mismatch");
+            const u32 textureHandle = spriteAsset->texture->textureHandle;
+            if (outBatches.GetNum() == 0 || outBatches[outBatches.GetNum() - 1].textureHandle != textureHandle) {
+                SpriteBatch batch = {};
+                batch.textureHandle = textureHandle;
+                batch.first = instanceCount;
+                outBatches.Add(batch);
+            }
 
-            glBindVertexArray(spriteRenderingState.vertexBuffer.vao);
-            VertexBufferUpdate(spriteRenderingState.vertexBuffer, 0, sizeof(vertices), vertices);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-            glBindVertexArray(0);
+            SpriteInstanceVertex& instance = outInstances[instanceCount];
+            instance.position = cmd.position;
+            instance.rotation = cmd.rotation;
+            instance.size[0] = (i16)size.x;
+            instance.size[1] = (i16)size.y;
+            instance.originOffset[0] = (i16)originOffset.x;
+            instance.originOffset[1] = (i16)originOffset.y;
+            const glm::vec4 frameUV = SpriteGetFrameUV(spriteAsset, cmd.frameIndex);
+            instance.uvRect[0] = PackUnorm16(frameUV.x);
+            instance.uvRect[1] = PackUnorm16(frameUV.y);
+            instance.uvRect[2] = PackUnorm16(frameUV.z);
+            instance.uvRect[3] = PackUnorm16(frameUV.w);
+            instance.color = color;
+
+            instanceCount++;
+            outBatches[outBatches.GetNum() - 1].count++;
         }
+
+        return instanceCount;
     }
 
     void LeEngine::DrawTextSetFont(FontAssetId id) {
@@ -1724,6 +2965,8 @@ namespace atto {
     }
 
     DrawEntryFont LeEngine::DrawTextCreate(const char* text, glm::vec2 pos) {
+        Assert(textRenderingState.font, "No font set");
+
         DrawEntryFont entry = {};
         entry.text = text;
         entry.pos = pos;
@@ -1734,14 +2977,24 @@ namespace atto {
         entry.underlinePercent = textRenderingState.underlinePercent;
         entry.color = textRenderingState.color;
 
-        BoxBounds bounds = DrawTextBounds(textRenderingState.font, text);
+        // Same as DrawTextBounds and DrawTextWidth in one walk, the width is where the last advance ends
+        BoxBounds bounds = {};
+        f32 width = 0.0f;
+        for (i32 i = 0; text[i] != '\0'; i++) {
+            const Glyph& ch = entry.font->glyphs[(i32)text[i]];
+            const f32 ypos = (f32)(-(ch.size.y - ch.bearing.y));
+            bounds.min.y = glm::min(bounds.min.y, ypos);
+            bounds.max.y = glm::max(bounds.max.y, ypos + (f32)ch.size.y);
+            width += (ch.advance >> 6);
+        }
+
+        bounds.max.x = width;
         if (entry.hAlignment == FONT_HALIGN_CENTER) {
-            f32 width = bounds.max.x - bounds.min.x;
             bounds.min.x -= width / 2.0f;
             bounds.max.x -= width / 2.0f;
         }
 
-        entry.textWidth = DrawTextWidth(textRenderingState.font, text);
+        entry.textWidth = width;
 
         bounds.Translate(entry.pos);
         entry.bounds = bounds;
@@ -1749,103 +3002,278 @@ namespace atto {
         return entry;
     }
 
-    void LeEngine::DrawText(const char* inText, glm::vec2 pos) {
-        DrawEntryFont entry = DrawTextCreate(inText, pos);
+    // Grows by doubling, SetNum alone would reallocate to the exact size on every quad
+    static FontVertex* TextAllocVertices(List<FontVertex>& vertices, i32 vertexCount) {
+        const i32 count = vertices.GetNum();
+        if (count + vertexCount > vertices.GetAllocated()) {
+            vertices.Resize(glm::max(glm::max(count * 2, count + vertexCount), 1024));
+        }
 
-        glm::mat4 p = glm::ortho(0.0f, (f32)mainSurfaceWidth, 0.0f, (f32)mainSurfaceHeight, -1.0f, 1.0f);
+        vertices.SetNum(count + vertexCount, false);
 
-        ShaderProgramBind(&textRenderingState.program);
-        ShaderProgramSetMat4("p", screenProjection);
-        ShaderProgramSetSampler("texture0", 0);
+        return vertices.GetData() + count;
+    }
+
+    static void TextWriteQuad(FontVertex* quad, f32 x0, f32 y0, f32 x1, f32 y1, glm::vec2 uv0, glm::vec2 uv1) {
+        quad[0] = { glm::vec2(x0, y0), glm::vec2(uv0.x, uv0.y) };
+        quad[1] = { glm::vec2(x0, y1), glm::vec2(uv0.x, uv1.y) };
+        quad[2] = { glm::vec2(x1, y1), glm::vec2(uv1.x, uv1.y) };
+        quad[3] = { glm::vec2(x0, y0), glm::vec2(uv0.x, uv0.y) };
+        quad[4] = { glm::vec2(x1, y1), glm::vec2(uv1.x, uv1.y) };
+        quad[5] = { glm::vec2(x1, y0), glm::vec2(uv1.x, uv0.y) };
+    }
 
-        glBindVertexArray(textRenderingState.vertexBuffer.vao);
+    // Pen starts at (x, y). Returns the vertex count, at most 6 a character
+    static i32 TextBuildGlyphQuads(const FontAsset* font, const char* text, f32 x, f32 y, FontVertex* outVertices) {
+        i32 vertexCount = 0;
+        for (i32 i = 0; text[i] != '\0'; i++) {
+            i32 index = (i32)text[i];
+            const Glyph& ch = font->glyphs[index];
 
-        f32 x = entry.pos.x;
-        f32 y = entry.pos.y;
-        const char* text = entry.text.GetCStr();
-        const f32 textWidth = entry.textWidth;
+            // Spaces and the like only move the cursor
+            if (ch.size.x > 0 && ch.size.y > 0) {
+                f32 xpos = x + ch.bearing.x;
+                f32 ypos = y + (ch.size.y - ch.bearing.y);
+                f32 w = (f32)ch.size.x;
+                f32 h = (f32)ch.size.y;
 
-        if (entry.hAlignment == FONT_HALIGN_CENTER) {
-            x -= textWidth / 2.0f;
+                TextWriteQuad(outVertices + vertexCount, xpos, ypos - h, xpos + w, ypos, ch.uv0, ch.uv1);
+                vertexCount += 6;
+            }
+
+            // now advance cursors for next glyph (note that advance is number of 1/64 pixels)
+            // bit shift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
+            x += (ch.advance >> 6);
+        }
+
+        return vertexCount;
+    }
+
+    static void TextLayoutCacheUnlinkLRU(TextLayoutCache& cache, i32 entryIndex) {
+        TextLayoutCacheEntry& entry = cache.entries[entryIndex];
+        if (entry.lruPrev != -1) {
+            cache.entries[entry.lruPrev].lruNext = entry.lruNext;
+        }
+        else {
+            cache.lruHead = entry.lruNext;
+        }
+
+        if (entry.lruNext != -1) {
+            cache.entries[entry.lruNext].lruPrev = entry.lruPrev;
+        }
+        else {
+            cache.lruTail = entry.lruPrev;
+        }
+    }
+
+    static void TextLayoutCachePushLRU(TextLayoutCache& cache, i32 entryIndex) {
+        TextLayoutCacheEntry& entry = cache.entries[entryIndex];
+        entry.lruPrev = -1;
+        entry.lruNext = cache.lruHead;
+        if (cache.lruHead != -1) {
+            cache.entries[cache.lruHead].lruPrev = entryIndex;
+        }
+        else {
+            cache.lruTail = entryIndex;
+        }
+        cache.lruHead = entryIndex;
+    }
+
+    TextLayoutCacheEntry* LeEngine::DrawTextGetLayout(FontAsset* font, FontHAlignment hAlignment, const char* text) {
+        TextLayoutCache& cache = textRenderingState.layoutCache;
+
+        const i32 length = (i32)StringHash::ConstStrLen(text);
+        if (length > TextLayoutCache::MAX_GLYPHS) {
+            return nullptr;
         }
 
-        if (entry.underlineThinkness > 0.0f && entry.underlinePercent > 0.0f) {
-            ShaderProgramSetInt("mode", 1);
-            ShaderProgramSetVec4("color", glm::vec4(1, 1, 1, 1));
+        const u32 hash = StringHash::DEKHash(text, (u32)length);
+        const u32 fontBits = (u32)((uintptr_t)font >> 4);
+        const i32 bucket = (i32)((hash ^ (fontBits * 2654435761u) ^ ((u32)hAlignment * 40503u)) & (TextLayoutCache::BUCKET_COUNT - 1));
+
+        for (i32 entryIndex = cache.buckets[bucket]; entryIndex != -1; entryIndex = cache.entries[entryIndex].next) {
+            TextLayoutCacheEntry& entry = cache.entries[entryIndex];
+            if (entry.hash == hash && entry.length == length && entry.font == font && entry.hAlignment == hAlignment &&
+                std::memcmp(entry.text.GetCStr(), text, length) == 0) {
+                if (cache.lruHead != entryIndex) {
+                    TextLayoutCacheUnlinkLRU(cache, entryIndex);
+                    TextLayoutCachePushLRU(cache, entryIndex);
+                }
+                renderingStats.textLayoutHitCount++;
+                return &entry;
+            }
+        }
+
+        renderingStats.textLayoutMissCount++;
 
-            f32 xpos = x;
-            f32 ypos = y - entry.underlineThinkness - 1.0f;
-            f32 w = textWidth * entry.underlinePercent;
-            f32 h = entry.underlineThinkness;
+        // First miss only remembers the string, it gets a slot if it misses again
+        if (cache.missedHashes[bucket] != hash) {
+            cache.missedHashes[bucket] = hash;
+            return nullptr;
+        }
+
+        i32 entryIndex = -1;
+        if (cache.entryCount < TextLayoutCache::ENTRY_CAPCITY) {
+            entryIndex = cache.entryCount++;
+        }
+        else {
+            // Evict the least recently used one and unlink it from its bucket
+            entryIndex = cache.lruTail;
+            TextLayoutCacheUnlinkLRU(cache, entryIndex);
 
-            if (entry.hAlignment == FONT_HALIGN_CENTER) {
-                xpos = x + textWidth / 2.0f - w / 2.0f;
+            i32* link = &cache.buckets[cache.entries[entryIndex].bucket];
+            while (*link != entryIndex) {
+                link = &cache.entries[*link].next;
             }
+            *link = cache.entries[entryIndex].next;
+        }
+
+        TextLayoutCacheEntry& entry = cache.entries[entryIndex];
+        entry.font = font;
+        entry.hAlignment = hAlignment;
+        entry.hash = hash;
+        entry.length = length;
+        entry.text = text;
+
+        f32 width = 0.0f;
+        for (i32 i = 0; i < length; i++) {
+            width += (font->glyphs[(i32)text[i]].advance >> 6);
+        }
+
+        FontVertex* vertices = cache.vertices.GetData() + entryIndex * TextLayoutCache::MAX_GLYPHS * 6;
+        entry.textWidth = width;
+        entry.vertexCount = TextBuildGlyphQuads(font, text, hAlignment == FONT_HALIGN_CENTER ? -width / 2.0f : 0.0f, 0.0f, vertices);
+
+        entry.bucket = bucket;
+        entry.next = cache.buckets[bucket];
+        cache.buckets[bucket] = entryIndex;
+        TextLayoutCachePushLRU(cache, entryIndex);
+
+        return &entry;
+    }
+
+    void LeEngine::DrawText(const char* text, glm::vec2 pos) {
+        FontAsset* font = textRenderingState.font;
+        Assert(font, "No font set");
 
-            f32 vertices[6][4] = {
-                { xpos,     ypos + h,   0.0f, 0.0f },
-                { xpos,     ypos,       0.0f, 1.0f },
-                { xpos + w, ypos,       1.0f, 1.0f },
+        const FontHAlignment hAlignment = textRenderingState.hAlignment;
 
-                { xpos,     ypos + h,   0.0f, 0.0f },
-                { xpos + w, ypos,       1.0f, 1.0f },
-                { xpos + w, ypos + h,   1.0f, 0.0f }
-            };
+        List<FontVertex>& vertices = textRenderingState.vertices;
+        List<SpriteBatch>& batches = textRenderingState.batches;
+        if (batches.GetNum() == 0 || batches[batches.GetNum() - 1].textureHandle != font->textureHandle) {
+            SpriteBatch& batch = batches.Alloc();
+            batch.textureHandle = font->textureHandle;
+            batch.first = vertices.GetNum();
+            batch.count = 0;
+        }
 
-            glBindBuffer(GL_ARRAY_BUFFER, textRenderingState.vertexBuffer.vbo);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        SpriteBatch& batch = batches[batches.GetNum() - 1];
+
+        f32 textWidth = 0.0f;
+        const TextLayoutCacheEntry* layout = DrawTextGetLayout(font, hAlignment, text);
+        if (layout != nullptr) {
+            // The cached quads are around the origin, they only need moving
+            const FontVertex* src = textRenderingState.layoutCache.vertices.GetData() + (layout - textRenderingState.layoutCache.entries.GetData()) * TextLayoutCache::MAX_GLYPHS * 6;
+            FontVertex* dst = TextAllocVertices(vertices, layout->vertexCount);
+            for (i32 vertexIndex = 0; vertexIndex < layout->vertexCount; vertexIndex++) {
+                dst[vertexIndex].position = src[vertexIndex].position + pos;
+                dst[vertexIndex].uv = src[vertexIndex].uv;
+            }
 
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            batch.count += layout->vertexCount;
+            textWidth = layout->textWidth;
         }
+        else {
+            DrawEntryFont entry = DrawTextCreate(text, pos);
+            textWidth = entry.textWidth;
 
-        ShaderProgramSetInt("mode", 0);
-        ShaderProgramSetTexture(0, entry.font->textureHandle);
+            const f32 x = hAlignment == FONT_HALIGN_CENTER ? pos.x - textWidth / 2.0f : pos.x;
+            const i32 maxVertexCount = entry.text.GetLength() * 6;
+            FontVertex* dst = TextAllocVertices(vertices, maxVertexCount);
+            const i32 vertexCount = TextBuildGlyphQuads(font, entry.text.GetCStr(), x, pos.y, dst);
+            vertices.SetNum(vertices.GetNum() - maxVertexCount + vertexCount, false);
 
-        for (i32 i = 0; text[i] != '\0'; i++) {
-            i32 index = (i32)text[i];
-            Glyph& ch = entry.font->glyphs[index];
+            batch.count += vertexCount;
+        }
 
-            f32 xpos = x + ch.bearing.x;
-            f32 ypos = y + (ch.size.y - ch.bearing.y);
-            f32 w = (f32)ch.size.x;
-            f32 h = (f32)ch.size.y;
+        const f32 underlineThinkness = textRenderingState.underlineThinkness;
+        const f32 underlinePercent = textRenderingState.underlinePercent;
+        if (underlineThinkness > 0.0f && underlinePercent > 0.0f) {
+            f32 w = textWidth * underlinePercent;
+            f32 h = underlineThinkness;
+            f32 xpos = hAlignment == FONT_HALIGN_CENTER ? pos.x - w / 2.0f : pos.x;
+            f32 ypos = pos.y - underlineThinkness - 1.0f;
+
+            TextWriteQuad(TextAllocVertices(textRenderingState.underlineVertices, 6), xpos, ypos + h, xpos + w, ypos, glm::vec2(0, 0), glm::vec2(1, 1));
+        }
+    }
+
+    void LeEngine::DrawTextRender() {
+        List<FontVertex>& vertices = textRenderingState.vertices;
+        List<SpriteBatch>& batches = textRenderingState.batches;
+        List<FontVertex>& underlineVertices = textRenderingState.underlineVertices;
+        if (vertices.GetNum() == 0 && underlineVertices.GetNum() == 0) {
+            batches.SetNum(0, false);
+            return;
+        }
 
-            glm::vec2 uv0 = ch.uv0;
-            glm::vec2 uv1 = ch.uv1;
+        ShaderProgramBind(&textRenderingState.program);
+        RenderStateBindVertexArray(textRenderingState.vertexBuffer.vao);
+
+        const i32 underlineVertexCount = underlineVertices.GetNum();
+        i32 firstVertex = 0;
+        if (underlineVertexCount > 0 && StreamingVertexBufferWrite(underlineVertices.GetData(), underlineVertexCount * sizeof(FontVertex), sizeof(FontVertex), firstVertex)) {
+            ShaderProgramSetInt(textRenderingState.modeUniform, 1);
+            ShaderProgramSetVec4(textRenderingState.colorUniform, glm::vec4(1, 1, 1, 1));
+            glDrawArrays(GL_TRIANGLES, firstVertex, underlineVertexCount);
+            renderingStats.drawCallCount++;
+        }
 
-            f32 vertices[6][4] = {
-                { xpos,     ypos - h,   uv0.x, uv0.y },
-                { xpos,     ypos,       uv0.x, uv1.y },
-                { xpos + w, ypos,       uv1.x, uv1.y },
+        ShaderProgramSetInt(textRenderingState.modeUniform, 0);
+
+        // Runs that share an atlas are gathered into one copy and one draw, text doesn't overlap so the order between atlases doesn't matter
+        const i32 batchCount = batches.GetNum();
+        for (i32 batchIndex = 0; batchIndex < batchCount; batchIndex++) {
+            const u32 textureHandle = batches[batchIndex].textureHandle;
+            if (batches[batchIndex].count < 0) {
+                continue;
+            }
 
-                { xpos,     ypos - h,   uv0.x, uv0.y },
-                { xpos + w, ypos,       uv1.x, uv1.y },
-                { xpos + w, ypos - h,   uv1.x, uv0.y }
-            };
+            i32 vertexCount = 0;
+            for (i32 otherIndex = batchIndex; otherIndex < batchCount; otherIndex++) {
+                if (batches[otherIndex].textureHandle == textureHandle && batches[otherIndex].count > 0) {
+                    vertexCount += batches[otherIndex].count;
+                }
+            }
 
-            //f32 vertices[6][4] = {
-            //    { xpos,     ypos,           uv0.x, uv1.y },
-            //    { xpos,     ypos + h,       uv0.x, uv0.y },
-            //    { xpos + w, ypos + h,       uv1.x, uv0.y },
+            if (vertexCount == 0) {
+                continue;
+            }
 
-            //    { xpos,     ypos,           uv0.x, uv1.y },
-            //    { xpos + w, ypos + h,       uv1.x, uv0.y },
-            //    { xpos + w, ypos,           uv1.x, uv1.y }
-            //};
+            FontVertex* dst = (FontVertex*)StreamingVertexBufferMap(vertexCount * sizeof(FontVertex), sizeof(FontVertex), firstVertex);
+            if (dst == nullptr) {
+                break;
+            }
 
-            glBindBuffer(GL_ARRAY_BUFFER, textRenderingState.vertexBuffer.vbo);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            for (i32 otherIndex = batchIndex; otherIndex < batchCount; otherIndex++) {
+                SpriteBatch& other = batches[otherIndex];
+                if (other.textureHandle == textureHandle && other.count > 0) {
+                    std::memcpy(dst, vertices.GetData() + other.first, other.count * sizeof(FontVertex));
+                    dst += other.count;
+                    other.count = -1;   // Done
+                }
+            }
 
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            StreamingVertexBufferUnmap();
 
-            // now advance cursors for next glyph (note that advance is number of 1/64 pixels)
-            // bit shift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
-            x += (ch.advance >> 6);
+            ShaderProgramSetTexture(0, textureHandle);
+            glDrawArrays(GL_TRIANGLES, firstVertex, vertexCount);
+            renderingStats.drawCallCount++;
         }
 
-        glBindVertexArray(0);
+        vertices.SetNum(0, false);
+        batches.SetNum(0, false);
+        underlineVertices.SetNum(0, false);
     }
 
     void LeEngine::DrawText(SmallString text, glm::vec2 pos) {
@@ -1854,7 +3282,7 @@ namespace atto {
 
     void LeEngine::DEBUGPushLine(glm::vec2 a, glm::vec2 b) {
         const i32 newCount = debugRenderingState.lines.GetCount() + 2;
-        if (newCount * sizeof(DebugLineVertex) > debugRenderingState.vertexBufer.size) {
+        if (newCount > debugRenderingState.lines.GetCapcity()) {
             ATTOINFO("To many debug lines!!");
             return;
         }
@@ -1877,7 +3305,7 @@ namespace atto {
 
     void LeEngine::DEBUGPushCircle(glm::vec2 pos, f32 radius) {
         const i32 newCount = debugRenderingState.lines.GetCount() + 2 * 32;
-        if (newCount * sizeof(DebugLineVertex) > debugRenderingState.vertexBufer.size) {
+        if (newCount > debugRenderingState.lines.GetCapcity()) {
             ATTOINFO("To many debug lines!!");
             return;
         }
@@ -1913,12 +3341,16 @@ namespace atto {
             return;
         }
 
-        glNamedBufferSubData(debugRenderingState.vertexBufer.vbo, 0, vertexSize, debugRenderingState.lines.GetData());
+        i32 firstVertex = 0;
+        if (!StreamingVertexBufferWrite(debugRenderingState.lines.GetData(), vertexSize, sizeof(DebugLineVertex), firstVertex)) {
+            debugRenderingState.lines.Clear();
+            return;
+        }
 
         ShaderProgramBind(&debugRenderingState.program);
-        ShaderProgramSetMat4("p", cameraProjection * cameraView);
-        glBindVertexArray(debugRenderingState.vertexBufer.vao);
-        glDrawArrays(GL_LINES, 0, vertexCount);
+        RenderStateBindVertexArray(debugRenderingState.vertexBufer.vao);
+        glDrawArrays(GL_LINES, firstVertex, vertexCount);
+        renderingStats.drawCallCount++;
 
         debugRenderingState.lines.Clear();
     }
@@ -1947,49 +3379,73 @@ namespace atto {
         }
     }
 
-    VertexBuffer LeEngine::SubmitVertexBuffer(i32 sizeBytes, const void* data, VertexLayoutType layoutType, bool dyanmic) {
-        VertexBuffer buffer = {};
-        buffer.size = sizeBytes;
-
-        glGenVertexArrays(1, &buffer.vao);
-        glGenBuffers(1, &buffer.vbo);
-
-        glBindVertexArray(buffer.vao);
-
-        glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
-        glBufferData(GL_ARRAY_BUFFER, buffer.size, data, dyanmic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
-
+    // Attribute pointers for the layout, against whatever is bound to GL_ARRAY_BUFFER. Returns the stride.
+    static i32 VertexLayoutSetAttributes(VertexLayoutType layoutType) {
+        i32 stride = 0;
         switch (layoutType) {
         case VERTEX_LAYOUT_TYPE_SHAPE: {
-            buffer.stride = sizeof(ShapeVertex);
+            stride = sizeof(ShapeVertex);
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(0, 2, GL_FLOAT, false, stride, (void*)offsetof(ShapeVertex, position));
+            glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, true, stride, (void*)offsetof(ShapeVertex, color));
+        } break;
+
+        case VERTEX_LAYOUT_TYPE_SHAPE_INSTANCE: {
+            stride = sizeof(ShapeInstanceVertex);
             glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 2, GL_FLOAT, false, buffer.stride, 0);
+            glEnableVertexAttribArray(1);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(0, 4, GL_FLOAT, false, stride, (void*)offsetof(ShapeInstanceVertex, center));
+            glVertexAttribPointer(1, 3, GL_FLOAT, false, stride, (void*)offsetof(ShapeInstanceVertex, rotation));
+            glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, true, stride, (void*)offsetof(ShapeInstanceVertex, color));
+            glVertexAttribDivisor(0, 1);
+            glVertexAttribDivisor(1, 1);
+            glVertexAttribDivisor(2, 1);
         } break;
 
         case VERTEX_LAYOUT_TYPE_SPRITE: {
-            buffer.stride = sizeof(SpriteVertex);
+            // Positions go to the shader as plain floats, it applies the fixed point scale and the batch origin
+            stride = sizeof(SpriteVertex);
             glEnableVertexAttribArray(0);
             glEnableVertexAttribArray(1);
             glEnableVertexAttribArray(2);
-            glVertexAttribPointer(0, 2, GL_FLOAT, false, buffer.stride, 0);
-            glVertexAttribPointer(1, 2, GL_FLOAT, false, buffer.stride, (void*)(2 * sizeof(f32)));
-            glVertexAttribPointer(2, 4, GL_FLOAT, false, buffer.stride, (void*)((2 + 2) * sizeof(f32)));
+            glVertexAttribPointer(0, 2, GL_SHORT, false, stride, (void*)offsetof(SpriteVertex, position));
+            glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, true, stride, (void*)offsetof(SpriteVertex, uv));
+            glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, true, stride, (void*)offsetof(SpriteVertex, color));
         } break;
 
         case VERTEX_LAYOUT_TYPE_FONT: {
-            buffer.stride = sizeof(FontVertex);
+            stride = sizeof(FontVertex);
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(0, 2, GL_FLOAT, false, stride, 0);
+            glVertexAttribPointer(1, 2, GL_FLOAT, false, stride, (void*)(2 * sizeof(f32)));
+        } break;
+
+        case VERTEX_LAYOUT_TYPE_SPRITE_INSTANCE: {
+            // Every attribute steps once per instance, the quad's corners come from gl_VertexID
+            stride = sizeof(SpriteInstanceVertex);
             glEnableVertexAttribArray(0);
             glEnableVertexAttribArray(1);
-            glVertexAttribPointer(0, 2, GL_FLOAT, false, buffer.stride, 0);
-            glVertexAttribPointer(1, 2, GL_FLOAT, false, buffer.stride, (void*)(2 * sizeof(f32)));
+            glEnableVertexAttribArray(2);
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(0, 3, GL_FLOAT, false, stride, (void*)offsetof(SpriteInstanceVertex, position));
+            glVertexAttribPointer(1, 4, GL_SHORT, false, stride, (void*)offsetof(SpriteInstanceVertex, size));
+            glVertexAttribPointer(2, 4, GL_UNSIGNED_SHORT, true, stride, (void*)offsetof(SpriteInstanceVertex, uvRect));
+            glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, true, stride, (void*)offsetof(SpriteInstanceVertex, color));
+            glVertexAttribDivisor(0, 1);
+            glVertexAttribDivisor(1, 1);
+            glVertexAttribDivisor(2, 1);
+            glVertexAttribDivisor(3, 1);
         } break;
 
         case VERTEX_LAYOUT_TYPE_DEBUG_LINE: {
-            buffer.stride = sizeof(DebugLineVertex);
+            stride = sizeof(DebugLineVertex);
             glEnableVertexAttribArray(0);
             glEnableVertexAttribArray(1);
-            glVertexAttribPointer(0, 2, GL_FLOAT, false, buffer.stride, 0);
-            glVertexAttribPointer(1, 4, GL_FLOAT, false, buffer.stride, (void*)(2 * sizeof(f32)));
+            glVertexAttribPointer(0, 2, GL_FLOAT, false, stride, 0);
+            glVertexAttribPointer(1, 4, GL_FLOAT, false, stride, (void*)(2 * sizeof(f32)));
         } break;
 
         default: {
@@ -1997,17 +3453,61 @@ namespace atto {
         }
         }
 
-        glBindVertexArray(0);
+        return stride;
+    }
+
+    VertexBuffer LeEngine::SubmitVertexBuffer(i32 sizeBytes, const void* data, VertexLayoutType layoutType, bool dyanmic) {
+        VertexBuffer buffer = {};
+        buffer.size = sizeBytes;
+
+        glGenVertexArrays(1, &buffer.vao);
+        glGenBuffers(1, &buffer.vbo);
+
+        RenderStateBindVertexArray(buffer.vao);
+
+        RenderStateBindArrayBuffer(buffer.vbo);
+        glBufferData(GL_ARRAY_BUFFER, buffer.size, data, dyanmic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+
+        buffer.stride = VertexLayoutSetAttributes(layoutType);
+
+        return buffer;
+    }
+
+    VertexBuffer LeEngine::SubmitStreamingVertexBuffer(VertexLayoutType layoutType) {
+        // Attributes start at the beginning of the streaming buffer, draws pick their data with the first vertex or base instance
+        VertexBuffer buffer = {};
+        buffer.vbo = streamingVertexBuffer.buffer;
+
+        glGenVertexArrays(1, &buffer.vao);
+        RenderStateBindVertexArray(buffer.vao);
+        RenderStateBindArrayBuffer(buffer.vbo);
+
+        buffer.stride = VertexLayoutSetAttributes(layoutType);
 
         return buffer;
     }
 
+    // Goes in front of every shader source, the sources themselves start after the version line. The block
+    // has to stay in step with the FrameUniforms struct.
+    static const char* SHADER_SOURCE_HEADER = R"(
+        #version 330 core
+
+        layout (std140) uniform FrameUniforms {
+            mat4 cameraViewProjection;
+            mat4 screenProjection;
+            vec4 surfaceSize;
+        };
+    )";
+
     ShaderProgram LeEngine::SubmitShaderProgram(const char* vertexSource, const char* fragmentSource) {
         ShaderProgram program = {};
 
+        const char* vertexSources[] = { SHADER_SOURCE_HEADER, vertexSource };
+        const char* fragmentSources[] = { SHADER_SOURCE_HEADER, fragmentSource };
+
         u32 vertexShader;
         vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexSource, NULL);
+        glShaderSource(vertexShader, 2, vertexSources, NULL);
         glCompileShader(vertexShader);
         if (!GLCheckShaderCompilationErrors(vertexShader)) {
             return {};
@@ -2015,7 +3515,7 @@ namespace atto {
 
         u32 fragmentShader;
         fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+        glShaderSource(fragmentShader, 2, fragmentSources, NULL);
         glCompileShader(fragmentShader);
         if (!GLCheckShaderCompilationErrors(fragmentShader)) {
             return {};
@@ -2032,6 +3532,33 @@ namespace atto {
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
 
+        const u32 frameUniformsIndex = glGetUniformBlockIndex(program.programHandle, "FrameUniforms");
+        if (frameUniformsIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program.programHandle, frameUniformsIndex, GlobalRenderingState::FRAME_UNIFORMS_BINDING);
+        }
+
+        // Resolve every uniform now, the draw code asks for handles once and never by name again
+        i32 activeUniformCount = 0;
+        glGetProgramiv(program.programHandle, GL_ACTIVE_UNIFORMS, &activeUniformCount);
+        for (i32 activeUniformIndex = 0; activeUniformIndex < activeUniformCount; activeUniformIndex++) {
+            char name[SmallString::CAPCITY] = {};
+            i32 size = 0;
+            u32 type = 0;
+            glGetActiveUniform(program.programHandle, (u32)activeUniformIndex, sizeof(name), nullptr, &size, &type, name);
+
+            // Block members don't have a location
+            const i32 location = glGetUniformLocation(program.programHandle, name);
+            if (location < 0) {
+                continue;
+            }
+
+            ShaderUniform uniform = {};
+            uniform.name = name;
+            uniform.location = location;
+            uniform.type = type;
+            program.uniforms.Add(uniform);
+        }
+
         return program;
     }
 
@@ -2050,6 +3577,7 @@ namespace atto {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
         glBindTexture(GL_TEXTURE_2D, 0);
+        globalRenderingState.boundTextures[0] = 0; // Unit 0 is the active one
 
         return textureHandle;
     }
@@ -2276,6 +3804,13 @@ namespace atto {
                 sprite.frameCount = spriteData["frameCount"].get<i32>();
                 sprite.frameSize.x = spriteData["frameSize"]["x"].get<f32>();
                 sprite.frameSize.y = spriteData["frameSize"]["y"].get<f32>();
+                sprite.framesPerRow = sprite.frameCount;
+                if (spriteData.contains("framesPerRow")) {
+                    sprite.framesPerRow = spriteData["framesPerRow"].get<i32>();
+                }
+                if (spriteData.contains("frameDuration")) {
+                    sprite.frameDuration = spriteData["frameDuration"].get<f32>();
+                }
 
                 std::string origin = spriteData["origin"].get<std::string>();
                 if (origin == "CENTER") {
@@ -2293,6 +3828,91 @@ namespace atto {
 
     }
 
+    void LeEngine::SpriteAtlasCook() {
+        Clock clock;
+        clock.Start();
+
+        TextureAtlasBuilder builder;
+        builder.Begin(SpriteAtlas::PAGE_SIZE, SpriteAtlas::PADDING);
+
+        // Sprites that use the same texture share its region
+        List<u32> textureIds;
+        List<i32> textureRegions;
+        List<i32> spriteRegions;
+
+        const i32 spriteCount = registeredSprites.GetCount();
+        for (i32 spriteIndex = 0; spriteIndex < spriteCount; spriteIndex++) {
+            const SpriteAsset& sprite = registeredSprites[spriteIndex];
+            const i32 textureIndex = textureIds.FindIndex(sprite.textureId.GetValue());
+            if (textureIndex != -1) {
+                spriteRegions.Add(textureRegions[textureIndex]);
+                continue;
+            }
+
+            i32 regionIndex = -1;
+            const i32 assetCount = engineAssets.GetCount();
+            for (i32 assetIndex = 0; assetIndex < assetCount; assetIndex++) {
+                const EngineAsset& asset = engineAssets[assetIndex];
+                if (asset.type == ASSET_TYPE_TEXTURE && asset.id == sprite.textureId.ToRawId()) {
+                    i32 width = 0;
+                    i32 height = 0;
+                    i32 channels = 0;
+                    byte* pixelData = (byte*)stbi_load(asset.path.GetCStr(), &width, &height, &channels, 4);
+                    if (pixelData != nullptr) {
+                        regionIndex = builder.Add(pixelData, width, height);
+                        stbi_image_free(pixelData);
+                    }
+                    break;
+                }
+            }
+
+            textureIds.Add(sprite.textureId.GetValue());
+            textureRegions.Add(regionIndex);
+            spriteRegions.Add(regionIndex);
+        }
+
+        builder.Build();
+
+        spriteAtlas.pages.Clear();
+        const i32 pageCount = glm::min(builder.pages.GetNum(), SpriteAtlas::PAGE_CAPCITY);
+        for (i32 pageIndex = 0; pageIndex < pageCount; pageIndex++) {
+            TextureAtlasBuilder::Page& builtPage = builder.pages[pageIndex];
+
+            TextureAsset page = TextureAsset::CreateDefault();
+            page.width = builtPage.width;
+            page.height = builtPage.height;
+            page.channels = 4;
+            page.wrapMode = GL_CLAMP_TO_EDGE;
+            page.generateMipMaps = false;   // Smaller mips would blend across the padding
+            page.textureHandle = SubmitTextureR8B8G8A8(page.width, page.height, builtPage.pixels.GetData(), page.wrapMode, page.generateMipMaps);
+            spriteAtlas.pages.Add(page);
+        }
+
+        i32 atlasedCount = 0;
+        for (i32 spriteIndex = 0; spriteIndex < spriteCount; spriteIndex++) {
+            const i32 regionIndex = spriteRegions[spriteIndex];
+            if (regionIndex == -1) {
+                continue;
+            }
+
+            const TextureAtlasBuilder::Region& region = builder.regions[regionIndex];
+            if (region.page == -1 || region.page >= pageCount) {
+                continue;
+            }
+
+            SpriteAsset& sprite = registeredSprites[spriteIndex];
+            const TextureAsset* page = &spriteAtlas.pages[region.page];
+            sprite.texture = page;
+            sprite.uv0 = glm::vec2((f32)region.x / page->width, (f32)region.y / page->height);
+            sprite.uv1 = glm::vec2((f32)(region.x + region.width) / page->width, (f32)(region.y + region.height) / page->height);
+            SpriteBuildFrameUVs(&sprite);
+            atlasedCount++;
+        }
+
+        clock.End();
+        ATTOTRACE("Cooked %d of %d sprites into %d atlas pages in %f ms", atlasedCount, spriteCount, pageCount, clock.GetElapsedMilliseconds());
+    }
+
     bool LeEngine::LoadTextureAsset(const char* name, TextureAsset& textureAsset) {
         textureAsset.generateMipMaps = false;
 
@@ -2316,6 +3936,7 @@ namespace atto {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
         glBindTexture(GL_TEXTURE_2D, 0);
+        globalRenderingState.boundTextures[0] = 0; // Unit 0 is the active one
 
         stbi_image_free(pixelData);
 
@@ -2,6 +2,7 @@
 
 #include "AttoLib.h"
 #include "AttoMath.h"
+#include "AttoPathfinding.h"
 #include "AttoLua.h"
 #include "AttoRendering.h"
 
@@ -149,20 +150,38 @@ namespace atto
         const TextureAsset*     texture;
 
         // Animation stuffies
-        bool                    animated;
+        static const i32 FRAME_CAPCITY = 64;
+
+        bool                    animated;               // Has more than one frame and a frame duration
 
         glm::vec2               frameSize;
         i32                     frameCount;
+        i32                     framesPerRow;           // Frames go left to right, then top to bottom
+        f32                     frameDuration;          // Seconds
         SpriteOrigin            origin;
 
+        // uv0 (xy) and uv1 (zw) of every frame, built once the texture or atlas region is known
+        FixedList<glm::vec4, FRAME_CAPCITY> frameUVs;
+
         inline static SpriteAsset CreateDefault() {
             SpriteAsset spriteAsset = {};
             spriteAsset.uv1 = glm::vec2(1, 1);
             spriteAsset.frameCount = 1;
+            spriteAsset.framesPerRow = 1;
             return spriteAsset;
         }
     };
 
+    // Pages every registered sprite's texture is packed into when the sprites are cooked, so sprites of
+    // different types can share a batch. Sprites whose texture doesn't fit keep their own texture.
+    struct SpriteAtlas {
+        static const i32 PAGE_SIZE = 2048;
+        static const i32 PADDING = 2;
+        static const i32 PAGE_CAPCITY = 8;
+
+        FixedList<TextureAsset, PAGE_CAPCITY>   pages;  // Never moved, sprites point at them
+    };
+
     struct Glyph {
         glm::ivec2      size;       // Size of glyph
         glm::ivec2      bearing;    // Offset from baseline to left/top of glyph
@@ -193,6 +212,23 @@ namespace atto
         i32 stride;
     };
 
+    // One big buffer every per-frame vertex stream is written into. It is split into a region per frame in flight,
+    // a frame only writes into its own region and a fence says when the GPU is done reading it. Without buffer
+    // storage (GL 4.4) the whole buffer is orphaned when it fills up and ranges are mapped unsynchronized instead.
+    struct StreamingVertexBuffer {
+        static const i32 FRAME_COUNT = 3;
+        static const i32 FRAME_SIZE_BYTES = 4 * 1024 * 1024;
+
+        u32                 buffer;
+        bool                persistent;
+        byte*               persistentData;             // The whole buffer, mapped for as long as it lives
+        void*               frameFences[FRAME_COUNT];   // GLsync
+        i32                 frameIndex;
+        i32                 head;                       // Next free byte
+        i32                 end;                        // Where the current region stops
+        bool                mapped;
+    };
+
     struct VertexBufferIndexed {
         u32 vao;
         u32 vbo;
@@ -202,6 +238,15 @@ namespace atto
     struct ShaderUniform {
         SmallString name;
         i32 location;
+        u32 type;           // GL type, the setters check it
+    };
+
+    // Looked up once after the program is created and kept by whoever draws with it, so setting a
+    // uniform never goes through its name
+    struct ShaderUniformHandle {
+        u32 programHandle;
+        i32 location;
+        u32 type;
     };
 
     struct ShaderProgram {
@@ -308,11 +353,13 @@ namespace atto
         };
     };
     
+    // Triangulated polygons, every polygon of a frame goes in one stream
     struct ShapeVertex {
         glm::vec2 position;
+        u32       color;        // RGBA8
     };
 
-    // Values matter here
+    // Values matter here, the instanced shader switches on them
     enum ShapeType {
         DRAW_SHAPE_TYPE_RECT = 0,
         DRAW_SHAPE_TYPE_CIRCLE = 1,
@@ -320,31 +367,28 @@ namespace atto
         DRAW_SHAPE_TYPE_RECT_POLY = 3,
     };
 
-    struct DrawShapeCommand {
-        ShapeType   type;
-        glm::vec4   color;
-        glm::mat4   projection;
-        union {
-            struct {
-                glm::vec2   tr;
-                glm::vec2   br;
-                glm::vec2   bl;
-                glm::vec2   tl;
-            };
-            struct {
-                glm::vec2   center;
-                f32         radius;
-            };
-            struct {
-                FixedList<glm::vec2, 16> poly;
-            };
-        };
+    // One per rect, circle or rounded rect. The vertex shader expands it into a quad and the fragment shader
+    // evaluates the shape's SDF in the quad's local space.
+    struct ShapeInstanceVertex {
+        glm::vec2   center;
+        glm::vec2   halfSize;
+        f32         rotation;
+        f32         radius;     // Circle radius or corner radius
+        f32         type;       // ShapeType
+        u32         color;      // RGBA8
     };
 
+    // Shapes are in screen pixels, the projection is set once per render
     struct ShapeRenderingState {
-        ShaderProgram                       program;
-        VertexBuffer                        vertexBuffer;
-        FixedList<DrawShapeCommand, 1024>   commands;
+        static const i32 INSTANCE_CAPCITY = 2048;
+        static const i32 POLYGON_VERTEX_CAPCITY = 8192;
+
+        ShaderProgram                                           program;            // Polygons
+        ShaderProgram                                           instancedProgram;   // Everything else
+        VertexBuffer                                            vertexBuffer;       // Streamed
+        VertexBuffer                                            instanceBuffer;     // Streamed
+        FixedList<ShapeVertex, POLYGON_VERTEX_CAPCITY>          polygonVertices;
+        FixedList<ShapeInstanceVertex, INSTANCE_CAPCITY>        instances;
     };
 
     struct UIRenderingState {
@@ -353,27 +397,105 @@ namespace atto
         nk_font_atlas* nkFontAtlas;
     };
 
+    // Positions are fixed point relative to the origin of the batch the vertex is drawn in, the color is the
+    // same for every corner of a sprite so RGBA8 is all it needs
     struct SpriteVertex {
-        glm::vec2 position;
-        glm::vec2 uv;
-        glm::vec4 color;
+        static const i32    POSITION_SCALE = 8;     // Steps per world unit
+
+        i16                 position[2];
+        u16                 uv[2];                  // Unorm16
+        u32                 color;                  // RGBA8
+    };
+
+    // Per sprite inputs of SpriteQuadKernel, one stream per field
+    struct SpriteQuadStreams {
+        List<f32>           positionX;          // Relative to the batch origin
+        List<f32>           positionY;
+        List<f32>           rotation;
+        List<f32>           width;
+        List<f32>           height;
+        List<f32>           originX;            // Bottom left corner relative to the position, before rotation
+        List<f32>           originY;
+        List<f32>           u0;
+        List<f32>           v0;
+        List<f32>           u1;
+        List<f32>           v1;
+
+        void                SetCount(i32 count);
+    };
+
+    // Expands sprites into six SpriteVertex each, in the same layout DrawSpriteBuildVertices always produced.
+    // Expand runs 4 sprites an iteration with SSE2 and skips the rotation for groups where no sprite is rotated.
+    // ExpandScalar is the fallback for builds without SSE and handles the tail.
+    class SpriteQuadKernel {
+    public:
+        static const i32 LANE_COUNT = 4;
+
+        static void Expand(const SpriteQuadStreams& streams, i32 count, u32 color, SpriteVertex* outVertices);
+        static void ExpandScalar(const SpriteQuadStreams& streams, i32 first, i32 count, u32 color, SpriteVertex* outVertices);
+    };
+
+    // Highest sort key bits, so every sprite in a layer draws before the next layer
+    enum SpriteLayer {
+        SPRITE_LAYER_GROUND = 0,
+        SPRITE_LAYER_GROUND_DECAL,      // Selection rings and the like, under everything standing on the map
+        SPRITE_LAYER_WORLD,
     };
 
     struct DrawSpriteCommand {
         SpriteAsset*        spriteAsset;
-        glm::vec2           tilePos;
         glm::vec4           color;
         glm::vec2           position;
         f32                 rotation;
         i32                 frameIndex;
-        i32                 tileIndex;
+        u64                 sortKey;    // Layer (8) | isometric depth (24) | sub-tile depth (16) | texture (16)
+    };
+
+    // One per sprite for the instanced path, the vertex shader expands it into a quad and works out the frame's uvs
+    struct SpriteInstanceVertex {
+        glm::vec2           position;
+        f32                 rotation;
+        i16                 size[2];            // Frame size in pixels
+        i16                 originOffset[2];    // Bottom left corner relative to the position, before rotation
+        u16                 uvRect[4];          // uv0 and uv1 of the frame as unorm16, straight from the sprite's frame table
+        u32                 color;              // RGBA8
+    };
+
+    // Run of sprite vertices (or instances) that share a texture, drawn with a single call
+    struct SpriteBatch {
+        u32                 textureHandle;
+        i32                 first;
+        i32                 count;
+        glm::vec2           origin;             // What the batched path's vertex positions are relative to
+    };
+
+    enum SpriteRenderMode {
+        SPRITE_RENDER_MODE_BATCHED = 0,     // Six packed vertices per sprite built on the CPU
+        SPRITE_RENDER_MODE_INSTANCED,       // One SpriteInstanceVertex per sprite
     };
 
     struct SpriteRenderingState {
-        glm::vec4                           color;
-        ShaderProgram                       program;
-        VertexBuffer                        vertexBuffer;
-        FixedList<DrawSpriteCommand, 1024>  commands;
+        static const i32 COMMAND_CAPCITY = 1024;
+        static const i32 VERTICES_PER_SPRITE = 6;
+
+        SpriteRenderMode                                mode;
+        glm::vec4                                       color;
+        ShaderProgram                                   program;
+        ShaderUniformHandle                             batchOriginUniform;
+        ShaderProgram                                   instancedProgram;
+        VertexBuffer                                    vertexBuffer;   // Streamed, built straight into the streaming buffer
+        VertexBuffer                                    instanceBuffer; // Same, for the instanced path
+        FixedList<DrawSpriteCommand, COMMAND_CAPCITY>   commands;
+        List<SpriteVertex>                              vertices;       // Scratch for the ground chunk builds
+        SpriteQuadStreams                               quadStreams;
+        List<SpriteBatch>                               batches;
+
+        // Commands are drawn in sort key order
+        List<u64>                                       sortKeys;
+        List<i32>                                       sortIndices;
+        List<u64>                                       sortScratchKeys;
+        List<i32>                                       sortScratchIndices;
+        List<DrawSpriteCommand>                         sortedCommands;
     };
 
     enum FontHAlignment {
@@ -406,6 +528,39 @@ namespace atto
         BoxBounds           bounds;
     };
     
+    // Glyph quads of a string laid out relative to its origin, reused for as long as the same string is drawn
+    // with the same font and alignment
+    struct TextLayoutCacheEntry {
+        FontAsset*          font;
+        FontHAlignment      hAlignment;
+        u32                 hash;
+        i32                 length;
+        SmallString         text;
+        f32                 textWidth;
+        i32                 vertexCount;
+        i32                 bucket;
+        i32                 next;               // Next entry in the same bucket, -1 ends the chain
+        i32                 lruPrev;            // Toward the most recently used entry, -1 at the head
+        i32                 lruNext;            // Toward the least recently used entry, -1 at the tail
+    };
+
+    // Fixed slots of MAX_GLYPHS quads per entry, the least recently used entry is evicted when they run out.
+    // A string is only cached the second time it misses, so strings formatted fresh every frame (counters and
+    // the like) are laid out directly instead of pushing out the ones that are drawn again.
+    struct TextLayoutCache {
+        static const i32 ENTRY_CAPCITY = 1024;
+        static const i32 BUCKET_COUNT = 2048;   // Must be a power of 2
+        static const i32 MAX_GLYPHS = 32;       // Longer strings are laid out every time they're drawn
+
+        i32                             entryCount;
+        i32                             lruHead;
+        i32                             lruTail;
+        i32                             buckets[BUCKET_COUNT];
+        u32                             missedHashes[BUCKET_COUNT]; // Last string that missed in each bucket
+        List<TextLayoutCacheEntry>      entries;
+        List<FontVertex>                vertices;   // MAX_GLYPHS * 6 per entry
+    };
+
     struct TextRenderingState {
         FontAsset *         font;
         FontHAlignment      hAlignment;
@@ -414,7 +569,17 @@ namespace atto
         f32                 underlinePercent;
         glm::vec4           color;
         ShaderProgram       program;
-        VertexBuffer        vertexBuffer;
+        ShaderUniformHandle modeUniform;
+        ShaderUniformHandle colorUniform;
+        VertexBuffer        vertexBuffer;       // Streamed
+
+        // Everything drawn this frame, flushed by DrawTextRender with one draw per font atlas
+        List<FontVertex>    vertices;
+        List<SpriteBatch>   batches;            // Runs of vertices that use the same atlas, in the order they were added
+        List<FontVertex>    underlineVertices;
+
+        TextLayoutCache     layoutCache;
+        List<SmallString>   tileIndexLabels;    // For the F3 tile overlay, one per tile index up to Map::TILE_CAPCITY
     };
 
     struct DebugLineVertex {
@@ -430,14 +595,57 @@ namespace atto
     };
 
     enum VertexLayoutType {
-        VERTEX_LAYOUT_TYPE_SHAPE,           // Vec2(POS)
-        VERTEX_LAYOUT_TYPE_SPRITE,          // Vec2(POS), Vec2(UV), Vec4(COLOR)
+        VERTEX_LAYOUT_TYPE_SHAPE,           // Vec2(POS), Unorm8x4(COLOR)
+        VERTEX_LAYOUT_TYPE_SPRITE,          // I16x2(POS, fixed point from the batch origin), Unorm16x2(UV), Unorm8x4(COLOR)
         VERTEX_LAYOUT_TYPE_FONT,            // Vec2(POS), Vec2(UV)
         VERTEX_LAYOUT_TYPE_DEBUG_LINE,      // Vec2(POS), Vec4(COLOR)
+        VERTEX_LAYOUT_TYPE_SPRITE_INSTANCE, // Per instance: Vec3(POS, ROT), I16x4(SIZE, ORIGIN), Unorm16x4(UV), Unorm8x4(COLOR)
+        VERTEX_LAYOUT_TYPE_SHAPE_INSTANCE,  // Per instance: Vec4(CENTER, HALF SIZE), Vec3(ROT, RADIUS, TYPE), Unorm8x4(COLOR)
+    };
+
+    // Constants for the whole frame, a std140 block every program reads from the same binding. The GLSL side
+    // is declared once in SHADER_SOURCE_HEADER.
+    struct FrameUniforms {
+        glm::mat4                           cameraViewProjection;
+        glm::mat4                           screenProjection;
+        glm::vec4                           surfaceSize;    // Width, height, 1 / width, 1 / height
     };
 
     struct GlobalRenderingState {
+        static const u32 FRAME_UNIFORMS_BINDING = 0;
+        static const i32 TEXTURE_UNIT_COUNT = 4;
+        static const u32 UNKNOWN_BINDING = 0xFFFFFFFF;
+
         ShaderProgram *                     program;
+        u32                                 frameUniformBuffer;
+
+        // Mirror of what's bound on the GL side so binding the same thing again can be skipped.
+        // UNKNOWN_BINDING after something outside the engine (the UI) has touched the state.
+        u32                                 boundProgram;
+        u32                                 boundVertexArray;
+        u32                                 boundArrayBuffer;
+        u32                                 boundTextures[TEXTURE_UNIT_COUNT];
+        u32                                 blendEnabled;
+        u32                                 blendSrcFactor;
+        u32                                 blendDstFactor;
+    };
+
+    // Counted over one Render call
+    struct RenderingStats {
+        i32                                 drawCallCount;
+        i32                                 spriteCount;
+        i32                                 spriteBatchCount;
+        i32                                 spriteUploadBytes;
+        i32                                 streamedBytes;
+        i32                                 streamingWaitCount;     // Times a frame region was still in use by the GPU
+        i32                                 stateChangeCount;       // GL binds actually issued
+        i32                                 stateChangeSkippedCount;
+        i32                                 textLayoutHitCount;
+        i32                                 textLayoutMissCount;
+        i32                                 spriteCulledCount;      // Blockers and units left out, one per entity
+        i32                                 groundChunkCount;
+        i32                                 groundChunkCulledCount;
+        f64                                 renderMicroseconds;     // CPU time, not including the buffer swap
     };
 
     struct SpriteInstance {
@@ -473,8 +681,11 @@ namespace atto
         bool            active;
         SpriteAsset*    sprite;
         i32             currentFrameIndex;
-        f32             animationDuration;
+        f32             animationDuration;      // Worked out from the sprite the first time it steps
         f32             animationPlayhead;
+
+        // Advances and loops the playhead of an animated sprite and picks the frame under it
+        void            StepAnimation(f32 dt);
     };
 
     enum UnitTargetType {
@@ -491,16 +702,43 @@ namespace atto
         };
     };
 
-    struct Unit {
-        bool        active;
-        bool        isSelected;
-        bool        teamNumber;
-        Circle      localColldier;
-        UnitTarget  target;
-        f32         timeToNextFire;
-        f32         timeFiring;
-        glm::vec2   steering;
-        i32         health;
+    // Units are stored as parallel streams indexed by slot rather than as Entity structs, so the
+    // per-frame loops only pull the fields they actually read through the cache.
+    struct UnitStreams {
+        static const i32 CAPCITY = 2048;
+
+        // Hot, read or written every update
+        EntityId        id[CAPCITY];
+        bool            active[CAPCITY];
+        glm::vec2       pos[CAPCITY];
+        glm::vec2       vel[CAPCITY];
+        f32             colliderRad[CAPCITY];
+        u8              teamNumber[CAPCITY];
+        i32             health[CAPCITY];
+        UnitTarget      target[CAPCITY];
+        f32             timeToNextFire[CAPCITY];
+        f32             timeFiring[CAPCITY];
+        i32             spriteFrameIndex[CAPCITY];
+        i32             pathIndex[CAPCITY];         // Into Map::unitPaths, -1 when the unit isn't following a path
+        PathRequestHandle pathRequest[CAPCITY];     // Into Map::pathRequests, index -1 when no search is pending
+
+        // Cold, only read for selection and rendering
+        bool            isSelected[CAPCITY];
+        f32             rotation[CAPCITY];
+        BoxBounds       localBoundingBox[CAPCITY];
+        SpriteAsset*    sprite[CAPCITY];
+        SpriteAsset*    selectionSprite[CAPCITY];
+
+        // Slot allocation, generation is bumped on destroy so stale ids stop resolving
+        i32                         generation[CAPCITY];
+        FixedList<i32, CAPCITY>     freeSlots;
+
+        // Packed live slots for the loops to walk, alivePosition maps a slot back to its place in aliveSlots
+        FixedList<i32, CAPCITY>     aliveSlots;
+        i32                         alivePosition[CAPCITY];
+
+        // Destroyed slots stay in aliveSlots (inactive) until the end of the update so the loops never shift under themselves
+        FixedList<i32, CAPCITY>     pendingDestroySlots;
     };
     
     struct MapTile {
@@ -509,9 +747,21 @@ namespace atto
         glm::vec2           worldPos;
         bool                isBlocker;
         PolygonCollider     collider;
-        bool                reached;
-        bool                pathed;
-        MapTile*            parent;
+        BakedPolygonCollider bakedCollider;
+    };
+
+    // Integration and direction field towards one destination tile, shared by every unit ordered there
+    struct FlowField {
+        static const i32 CAPCITY = 1024;
+        static const i32 UNREACHABLE = 0x7FFFFFFF;
+
+        bool            valid;
+        i32             destinationTileX;
+        i32             destinationTileY;
+        u32             mapVersion;
+        u32             lastUsedTick;
+        i32             integration[CAPCITY];   // Cost to the destination, orthogonal steps are 10 and diagonal 14
+        glm::vec2       direction[CAPCITY];     // World space direction towards the cheapest neighbor
     };
 
     struct Entity {
@@ -521,13 +771,35 @@ namespace atto
         f32             rotation;
         BoxBounds       localBoundingBox;
         EntitySprite    sprite1;
-        EntitySprite    sprite2;
-        Unit            unit;
         MapTile         tile;
     };
 
+    // Tile path for a single unit, the waypoints are world space tile centers
+    struct UnitPath {
+        bool            inUse;
+        i32             nextWaypoint;
+        List<glm::vec2> waypoints;
+    };
+
+    // Static ground mesh for a square block of tiles. Ground tiles never move or change, so the vertices are
+    // built once when the map is created.
+    struct GroundChunk {
+        glm::ivec2          minTile;
+        glm::ivec2          maxTile;
+        i32                 vertexCount;
+        BoxBounds           bounds;         // World space, around every quad in the chunk
+        VertexBuffer        vertexBuffer;   // Sized for a full chunk
+        List<SpriteBatch>   batches;
+    };
+
     struct Map {
         static const i32                    TILE_CAPCITY = 1024;
+        static const i32                    UNIT_CAPCITY = UnitStreams::CAPCITY;
+        static const i32                    TEAM_COUNT = 2;
+        static const i32                    FLOW_FIELD_CACHE_COUNT = 8;
+        static const i32                    UNIT_PATH_CAPCITY = 64;
+        static const i32                    PATH_CLUSTER_SIZE = 16;
+        static const i32                    GROUND_CHUNK_SIZE = 16;
 
         i32                                 mapWidth;
         i32                                 mapHeight;
@@ -535,10 +807,40 @@ namespace atto
         i32                                 tileHeight;
         i32                                 tileHalfWidth;
         i32                                 tileHalfHeight;
+
+        // Bumped whenever the tiles change, flow fields built against an older version are rebuilt
+        u32                                 version;
         
         FixedList<Entity, TILE_CAPCITY>     groundTileEntities;
         FixedList<Entity, TILE_CAPCITY>     blockerTileEntities;
-        FixedList<Entity, 2048>             unitEntities;
+        UnitStreams                         units;
+
+        // Largest distance from a ground or blocker tile's position to a corner of its sprite, for culling
+        f32                                 tileSpriteMaxExtent;
+        i32                                 blockerCount;
+
+        // Ground tiles baked per chunk, row major
+        i32                                 groundChunksWide;
+        i32                                 groundChunksHigh;
+        List<GroundChunk>                   groundChunks;
+
+        // Rebuilt every update, cell size is the largest unit collider diameter
+        SpatialHashGrid<UNIT_CAPCITY>       unitGrid;
+        f32                                 unitGridMaxRadius;
+        f32                                 unitGridMaxSpriteExtent;
+
+        // Rebuilt every update, one per team with cells about a field of view wide, for finding enemies
+        SpatialHashGrid<UNIT_CAPCITY>       teamGrids[TEAM_COUNT];
+
+        FlowField                           flowFields[FLOW_FIELD_CACHE_COUNT];
+
+        // Walkability of every tile, mirrors the blockers
+        PathGrid                            pathGrid;
+        HierarchicalPathfinder              pathHierarchy;
+        UnitPath                            unitPaths[UNIT_PATH_CAPCITY];
+
+        // Unit path searches, serviced at the start of each update within a time budget
+        PathRequestQueue                    pathRequests;
     };
 
     class LeEngine {
@@ -559,23 +861,45 @@ namespace atto
         f32                                 WorldLengthToScreenLength(f32 worldLength);
         glm::vec2                           WorldDimensionToScreenDimension(glm::vec2 worldDim);
         glm::vec2                           GetMousePosWorldSpace();
+        BoxBounds                           CameraGetVisibleWorldBounds();
 
         void                                MapCreate(Map* map, const char *mapData, i32 mapWidth, i32 mapHeight);
-        Entity*                             MapCreateEntity();
-        Entity*                             MapGetEntity(const EntityId &id);
-        void                                MapDestroyEntity(Entity* entity);
+        EntityId                            MapCreateEntity();
+        i32                                 MapGetEntity(const EntityId &id);
+        void                                MapDestroyEntity(const EntityId &id);
         glm::vec2                           MapTilePosToWorldPos(Map *map, glm::vec2 tilePos);
         glm::vec2                           MapWorldPosToTilePos(Map *map, glm::vec2 worldPos);
         i32                                 MapTilePosToIndex(Map* map, glm::vec2 tilePos);
         i32                                 MapTilePosToIndex(Map* map, i32 x, i32 y);
+        bool                                MapWorldBoundsToTileRange(Map* map, const BoxBounds& worldBounds, glm::ivec2& minTile, glm::ivec2& maxTile);
+        PolygonCollider                     MapCreateBlockerCollider(Map* map);
+        void                                MapSetTileBlocker(Map* map, i32 x, i32 y, bool isBlocker);
+        void                                MapCreateGroundChunks(Map* map);
+        void                                MapBuildGroundChunk(Map* map, GroundChunk& chunk);
+        bool                                MapIsTileWalkable(Map* map, i32 x, i32 y);
         MapTile*                            MapGetTile(Map* map, glm::vec2 tilePos);
         MapTile*                            MapGetTile(Map* map, i32 x, i32 y);
         void                                MapGetTileNeighbors(Map* map, MapTile* tile, FixedList<MapTile*, 8>& neighbors);
         void                                MapGetTileNeighbors(Map* map, i32 x, i32 y, FixedList<MapTile*, 8>& neighbors);
+        void                                MapRebuildUnitGrid(Map* map);
+        void                                MapStepSpriteAnimations(Map* map, f32 dt);
+        void                                MapRebuildTeamGrids(Map* map, f32 cellSize);
+        i32                                 MapFindNearestEnemy(Map* map, i32 unitIndex, f32 radius);
+        FlowField*                          MapGetFlowField(Map* map, i32 destinationTileX, i32 destinationTileY);
+        void                                MapBuildFlowField(Map* map, FlowField* flowField, i32 destinationTileX, i32 destinationTileY);
+        glm::vec2                           MapSampleFlowField(Map* map, const FlowField* flowField, glm::vec2 worldPos);
+        bool                                MapFindPath(Map* map, glm::ivec2 startTilePos, glm::ivec2 goalTilePos, List<glm::ivec2>& outPath);
+        bool                                MapRequestUnitPath(Map* map, i32 unitIndex, glm::vec2 goalWorldPos);
+        bool                                MapPollUnitPathRequest(Map* map, i32 unitIndex);
+        void                                MapServicePathRequests(Map* map, f64 budgetMicroseconds);
+        glm::vec2                           MapFollowUnitPath(Map* map, i32 unitIndex);
+        void                                MapReleaseUnitPath(Map* map, i32 unitIndex);
+        void                                MapFlushDestroyedEntities(Map* map);
 
         BoxBounds                           EntityGetBoundingBox(const Entity& entity);
 
-        Circle                              UnitGetCollider(const Entity& unit);
+        Circle                              UnitGetCollider(Map* map, i32 unitIndex);
+        BoxBounds                           UnitGetBoundingBox(Map* map, i32 unitIndex);
         glm::vec2                           UnitSteerSeek(const Entity& unit, glm::vec2 target);
         glm::vec2                           UnitSteerFlee(Entity& unit);
         glm::vec2                           UnitSteerWander(Entity& entity);
@@ -602,25 +926,41 @@ namespace atto
         bool                                AudioIsSpeakerAlive(Speaker speaker);
 
         void                                ShaderProgramBind(ShaderProgram* program);
-        i32                                 ShaderProgramGetUniformLocation(const char* name);
-        void                                ShaderProgramSetInt(const char* name, i32 value);
-        void                                ShaderProgramSetSampler(const char* name, i32 value);
+        ShaderUniformHandle                 ShaderProgramGetUniform(ShaderProgram* program, const char* name);
+        void                                ShaderProgramSetInt(ShaderUniformHandle uniform, i32 value);
+        void                                ShaderProgramSetSampler(ShaderUniformHandle uniform, i32 value);
         void                                ShaderProgramSetTexture(i32 location, u32 textureHandle);
-        void                                ShaderProgramSetFloat(const char* name, f32 value);
-        void                                ShaderProgramSetVec2(const char* name, glm::vec2 value);
-        void                                ShaderProgramSetVec3(const char* name, glm::vec3 value);
-        void                                ShaderProgramSetVec4(const char* name, glm::vec4 value);
-        void                                ShaderProgramSetMat3(const char* name, glm::mat3 value);
-        void                                ShaderProgramSetMat4(const char* name, glm::mat4 value);
+        void                                ShaderProgramSetFloat(ShaderUniformHandle uniform, f32 value);
+        void                                ShaderProgramSetVec2(ShaderUniformHandle uniform, glm::vec2 value);
+        void                                ShaderProgramSetVec3(ShaderUniformHandle uniform, glm::vec3 value);
+        void                                ShaderProgramSetVec4(ShaderUniformHandle uniform, glm::vec4 value);
+        void                                ShaderProgramSetMat3(ShaderUniformHandle uniform, glm::mat3 value);
+        void                                ShaderProgramSetMat4(ShaderUniformHandle uniform, glm::mat4 value);
+        void                                DrawSubmitFrameUniforms();
+
+        void                                RenderStateInvalidate();
+        void                                RenderStateBindProgram(u32 programHandle);
+        void                                RenderStateBindVertexArray(u32 vertexArray);
+        void                                RenderStateBindArrayBuffer(u32 buffer);
+        void                                RenderStateBindTexture(i32 unit, u32 textureHandle);
+        void                                RenderStateSetBlend(bool enabled, u32 srcFactor, u32 dstFactor);
 
         void                                VertexBufferUpdate(VertexBuffer vertexBuffer, i32 offset, i32 size, const void* data);
+        void                                VertexBufferFree(VertexBuffer* vertexBuffer);
+
+        void                                StreamingVertexBufferBeginFrame();
+        void                                StreamingVertexBufferEndFrame();
+        // Room for sizeBytes, starting on a multiple of the stride so outFirst can be used as the first vertex
+        // or base instance. Returns null if the frame's region is full. Unmap before drawing from it.
+        void*                               StreamingVertexBufferMap(i32 sizeBytes, i32 stride, i32& outFirst);
+        void                                StreamingVertexBufferUnmap();
+        bool                                StreamingVertexBufferWrite(const void* data, i32 sizeBytes, i32 stride, i32& outFirst);
 
         void                                DrawSurfaceResized(i32 w, i32 h);
 
         void                                DrawClearSurface(const glm::vec4& color = glm::vec4(0, 0, 0, 1));
         void                                DrawEnableAlphaBlending();
         
-        DrawShapeCommand                    DrawShapeCreateCommand();
         void                                DrawShapeRect(glm::vec2 bl, glm::vec2 tr, const glm::vec4& color = glm::vec4(1, 1, 1, 1));
         void                                DrawShapeRectCenterDimRot(glm::vec2 center, glm::vec2 dim, f32 rot, const glm::vec4& color = glm::vec4(1, 1, 1, 1));
         void                                DrawShapeRectCenterDim(glm::vec2 center, glm::vec2 dim);
@@ -628,16 +968,23 @@ namespace atto
         void                                DrawShapeRoundRect(glm::vec2 bl, glm::vec2 tr, f32 radius = 10.0f);
         void                                DrawShapePolygon(const glm::vec2 * vertices, i32 vertexCount, const glm::vec4& color = glm::vec4(1, 1, 1, 1));
         void                                DrawShapePolygon(const PolygonCollider& polygon, const glm::vec4& color = glm::vec4(1, 1, 1, 1));
-        void                                DrawShapeAddCommand(const DrawShapeCommand& cmd);
+        void                                DrawShapeAddInstance(ShapeType type, glm::vec2 center, glm::vec2 halfSize, f32 rotation, f32 radius, const glm::vec4& color);
         void                                DrawShapeClearCommands();
         void                                DrawShapeRender();
 
         DrawSpriteCommand                   DrawSpriteCreateCommand();
         void                                DrawSprite(SpriteAsset* spriteAsset, glm::vec2 pos, f32 rotation, i32 frameIndex);
-        void                                DrawSprite(SpriteAsset* spriteAsset, glm::vec2 pos, f32 rotation, i32 frameIndex, glm::vec2 tilePos);
+        void                                DrawSprite(SpriteAsset* spriteAsset, glm::vec2 pos, f32 rotation, i32 frameIndex, SpriteLayer layer, glm::vec2 depthPos);
+        u64                                 DrawSpriteMakeSortKey(SpriteLayer layer, glm::vec2 depthPos, SpriteAsset* spriteAsset);
         void                                DrawSpriteAddCommand(const DrawSpriteCommand& cmd);
         void                                DrawSpriteClearCommands();
         void                                DrawSpriteRender();
+        void                                DrawGroundChunks(Map* map, const BoxBounds& visibleBounds);
+        BoxBounds                           DrawSpriteGetBounds(const SpriteAsset* spriteAsset, glm::vec2 pos, f32 rotation);
+        void                                DrawSpriteSortCommands(const DrawSpriteCommand* commands, i32 commandCount, List<DrawSpriteCommand>& outSorted);
+        bool                                DrawSpriteLoadTexture(SpriteAsset* spriteAsset);
+        i32                                 DrawSpriteBuildVertices(const DrawSpriteCommand* commands, i32 commandCount, SpriteVertex* outVertices, List<SpriteBatch>& outBatches);
+        i32                                 DrawSpriteBuildInstances(const DrawSpriteCommand* commands, i32 commandCount, SpriteInstanceVertex* outInstances, List<SpriteBatch>& outBatches);
 
         void                                InitializeUIRendering(AppState* app);
         void                                ShutdownUIRendering(AppState* app);
@@ -658,6 +1005,9 @@ namespace atto
         DrawEntryFont                       DrawTextCreate(const char* text, glm::vec2 pos);
         void                                DrawText(const char* text, glm::vec2 pos);
         void                                DrawText(SmallString text, glm::vec2 pos);
+        void                                DrawTextRender();
+        // Null when the string is too long to cache
+        TextLayoutCacheEntry*               DrawTextGetLayout(FontAsset* font, FontHAlignment hAlignment, const char* text);
 
         void                                DEBUGPushLine(glm::vec2 a, glm::vec2 b);
         void                                DEBUGPushRay(Ray2D ray);
@@ -665,6 +1015,15 @@ namespace atto
         void                                DEBUGPushCircle(Circle circle);
         void                                DEBUGPushBox(BoxBounds bounds);
         void                                DEBUGSubmit();
+        void                                DEBUGRunBenchmarks();
+        void                                DEBUGBenchmarkUnitCollision();
+        void                                DEBUGBenchmarkUnitStorage();
+        void                                DEBUGBenchmarkPathfinding();
+        void                                DEBUGBenchmarkHierarchicalPathfinding();
+        void                                DEBUGBenchmarkSpriteBuild();
+        void                                DEBUGBenchmarkSpriteSort();
+        void                                DEBUGBenchmarkSpriteQuadKernel();
+        void                                DEBUGCheckSpriteAnimation();
 
         void                                EditorToggleConsole();
 
@@ -679,6 +1038,8 @@ namespace atto
         i32                                 mainSurfaceHeight;
 
     private:
+        void                                InitializeFrameUniforms();
+        void                                InitializeStreamingVertexBuffer();
         void                                InitializeShapeRendering();
         void                                InitializeSpriteRendering();
         void                                InitializeTextRendering();
@@ -691,6 +1052,7 @@ namespace atto
         void                                Win32OnDirectoryChanged(const char* directory, DirectoryChangeType changeType);
 
         void                                RegisterAssets();
+        void                                SpriteAtlasCook();
         bool                                LoadTextureAsset(const char* name, TextureAsset& textureAsset);
         bool                                LoadAudioAsset(const char* name, AudioAsset& audioAsset);
         bool                                LoadFontAsset(const char* name, FontAsset& fontAsset);
@@ -698,6 +1060,7 @@ namespace atto
         bool                                LoadOGG(const char* filename, AudioAsset& audioAsset);
 
         VertexBuffer                        SubmitVertexBuffer(i32 sizeBytes, const void* data, VertexLayoutType layoutType, bool dyanmic);
+        VertexBuffer                        SubmitStreamingVertexBuffer(VertexLayoutType layoutType);
         ShaderProgram                       SubmitShaderProgram(const char* vertexSource, const char* fragmentSource);
         u32                                 SubmitTextureR8B8G8A8(i32 width, i32 height, byte* data, i32 wrapMode, bool generateMipMaps);
         u32                                 SubmitAudioClip(i32 sizeBytes, byte* data, i32 channels, i32 bitDepth, i32 sampleRate);
@@ -716,8 +1079,11 @@ namespace atto
         LargeString                         basePathSounds;
 
         GlobalRenderingState                globalRenderingState;
+        RenderingStats                      renderingStats;
+        RenderingStats                      lastFrameRenderingStats;
         ShapeRenderingState                 shapeRenderingState;
         SpriteRenderingState                spriteRenderingState;
+        StreamingVertexBuffer               streamingVertexBuffer;
         TextRenderingState                  textRenderingState;
         DebugRenderingState                 debugRenderingState;
         UIRenderingState                    uiRenderingState;
@@ -725,12 +1091,17 @@ namespace atto
 
         FixedList<EngineAsset, 2048>        engineAssets;      // These never get moved, so it's safe to store a pointer to them.
         FixedList<SpriteAsset, 2048>        registeredSprites; // These never get moved, so it's safe to store a pointer to them.
+        SpriteAtlas                         spriteAtlas;
 
         FixedList<Speaker,       8>        speakers;
 
         // Make this game state
         Map                                 demoMap;
         Map*                                currentMap;
+        AStarSearch                         pathSearch;
+        f64                                 pathRequestBudgetMicroseconds;  // Time spent on path searches per update
+        u32                                 updateTick;
+        i32                                 unitTargetAcquireInterval;  // Idle units look for a target every N updates, staggered by slot
         bool                                isDragging;
         glm::vec2                           startingDrag;
         glm::vec2                           endingDrag;
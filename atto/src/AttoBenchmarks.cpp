@@ -0,0 +1,579 @@
+#include "AttoAsset.h"
+
+namespace atto
+{
+    // Units as they were laid out before they moved into UnitStreams, only kept to benchmark against
+    struct BenchmarkFatUnit {
+        EntityId        id;
+        glm::vec2       pos;
+        glm::vec2       vel;
+        f32             rotation;
+        BoxBounds       localBoundingBox;
+        EntitySprite    sprite1;
+        EntitySprite    sprite2;
+        bool            active;
+        bool            isSelected;
+        bool            teamNumber;
+        Circle          localColldier;
+        UnitTarget      target;
+        f32             timeToNextFire;
+        f32             timeFiring;
+        glm::vec2       steering;
+        i32             health;
+        MapTile         tile;
+    };
+
+    static i32 BenchmarkCompareSpriteSortKey(const void* a, const void* b) {
+        const u64 keyA = ((const DrawSpriteCommand*)a)->sortKey;
+        const u64 keyB = ((const DrawSpriteCommand*)b)->sortKey;
+        return keyA < keyB ? -1 : (keyA > keyB ? 1 : 0);
+    }
+
+    void LeEngine::DEBUGRunBenchmarks() {
+        ATTOINFO("-- Running benchmarks --------------------------------- --");
+        DEBUGBenchmarkUnitCollision();
+        DEBUGBenchmarkUnitStorage();
+        DEBUGBenchmarkPathfinding();
+        DEBUGBenchmarkHierarchicalPathfinding();
+        DEBUGBenchmarkSpriteBuild();
+        DEBUGBenchmarkSpriteQuadKernel();
+        DEBUGBenchmarkSpriteSort();
+        DEBUGCheckSpriteAnimation();
+        ATTOINFO("-- Benchmarks complete -------------------------------- --");
+    }
+
+    void LeEngine::DEBUGBenchmarkUnitCollision() {
+        constexpr i32 maxUnitCount = 10000;
+        const i32 unitCounts[] = { 500, 2000, maxUnitCount };
+
+        // Too big for the stack
+        SpatialHashGrid<maxUnitCount>* grid = new SpatialHashGrid<maxUnitCount>();
+        List<Circle> colliders;
+
+        for (i32 countIndex = 0; countIndex < (i32)(sizeof(unitCounts) / sizeof(unitCounts[0])); countIndex++) {
+            const i32 unitCount = unitCounts[countIndex];
+            const f32 radius = 4.0f;
+
+            // Roughly the density of a battle, units a little over a diameter apart
+            const f32 areaSize = glm::sqrt((f32)unitCount) * radius * 2.5f;
+
+            colliders.SetNum(unitCount, true);
+            for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                colliders[unitIndex].pos = glm::vec2(Random(0.0f, areaSize), Random(0.0f, areaSize));
+                colliders[unitIndex].rad = radius;
+            }
+
+            i32 bruteForceHits = 0;
+            Clock bruteForceClock;
+            bruteForceClock.Start();
+            for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                for (i32 otherUnitIndex = 0; otherUnitIndex < unitCount; otherUnitIndex++) {
+                    if (otherUnitIndex == unitIndex) {
+                        continue;
+                    }
+
+                    Manifold manifold = {};
+                    if (colliders[otherUnitIndex].Collision(colliders[unitIndex], manifold)) {
+                        bruteForceHits++;
+                    }
+                }
+            }
+            bruteForceClock.End();
+
+            i32 gridHits = 0;
+            Clock gridClock;
+            gridClock.Start();
+            grid->Begin(radius * 2.0f);
+            for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                grid->Insert(unitIndex, colliders[unitIndex].pos);
+            }
+            grid->End();
+
+            const glm::vec2 reach = glm::vec2(radius * 2.0f);
+            for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                const Circle& collider = colliders[unitIndex];
+                grid->Query(collider.pos - reach, collider.pos + reach, [&](i32 otherUnitIndex) {
+                    if (otherUnitIndex == unitIndex) {
+                        return;
+                    }
+
+                    Manifold manifold = {};
+                    if (colliders[otherUnitIndex].Collision(collider, manifold)) {
+                        gridHits++;
+                    }
+                });
+            }
+            gridClock.End();
+
+            ATTOINFO("Unit collision %d units: all pairs %f ms, spatial hash %f ms (%d / %d contacts)",
+                unitCount, bruteForceClock.GetElapsedMilliseconds(), gridClock.GetElapsedMilliseconds(), bruteForceHits, gridHits);
+        }
+
+        delete grid;
+    }
+
+    void LeEngine::DEBUGBenchmarkUnitStorage() {
+        // The first count is the map's unit cap, the second is big enough to fall out of the caches entirely
+        const i32 unitCounts[] = { Map::UNIT_CAPCITY, 65536 };
+        const i32 passCount = 100;
+        const f32 dt = 1.0f / 60.0f;
+
+        List<BenchmarkFatUnit> fatUnits;
+        List<bool> active;
+        List<glm::vec2> pos;
+        List<glm::vec2> vel;
+        List<i32> targets;
+
+        for (i32 countIndex = 0; countIndex < (i32)(sizeof(unitCounts) / sizeof(unitCounts[0])); countIndex++) {
+            const i32 unitCount = unitCounts[countIndex];
+
+            fatUnits.SetNum(unitCount, true);
+            active.SetNum(unitCount, true);
+            pos.SetNum(unitCount, true);
+            vel.SetNum(unitCount, true);
+            targets.SetNum(unitCount, true);
+
+            for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                const glm::vec2 p = glm::vec2(Random(0.0f, 1000.0f), Random(0.0f, 1000.0f));
+                const glm::vec2 v = glm::vec2(Random(-1.0f, 1.0f), Random(-1.0f, 1.0f));
+
+                fatUnits[unitIndex] = {};
+                fatUnits[unitIndex].active = true;
+                fatUnits[unitIndex].pos = p;
+                fatUnits[unitIndex].vel = v;
+
+                active[unitIndex] = true;
+                pos[unitIndex] = p;
+                vel[unitIndex] = v;
+
+                // Random targets make the gather pass jump around memory like target lookups do
+                targets[unitIndex] = RandomInt(0, unitCount - 1);
+            }
+
+            // Integrate, a linear walk that only needs active, pos and vel
+            f32 fatChecksum = 0.0f;
+            Clock fatIntegrateClock;
+            fatIntegrateClock.Start();
+            for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+                for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                    BenchmarkFatUnit& unit = fatUnits[unitIndex];
+                    if (unit.active) {
+                        unit.pos += unit.vel * dt;
+                    }
+                }
+            }
+            fatIntegrateClock.End();
+
+            f32 streamChecksum = 0.0f;
+            Clock streamIntegrateClock;
+            streamIntegrateClock.Start();
+            for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+                for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                    if (active[unitIndex]) {
+                        pos[unitIndex] += vel[unitIndex] * dt;
+                    }
+                }
+            }
+            streamIntegrateClock.End();
+
+            // Gather, each unit reads the position of its target
+            Clock fatGatherClock;
+            fatGatherClock.Start();
+            for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+                for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                    const BenchmarkFatUnit& unit = fatUnits[unitIndex];
+                    fatChecksum += glm::distance2(unit.pos, fatUnits[targets[unitIndex]].pos);
+                }
+            }
+            fatGatherClock.End();
+
+            Clock streamGatherClock;
+            streamGatherClock.Start();
+            for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+                for (i32 unitIndex = 0; unitIndex < unitCount; unitIndex++) {
+                    streamChecksum += glm::distance2(pos[unitIndex], pos[targets[unitIndex]]);
+                }
+            }
+            streamGatherClock.End();
+
+            const i32 fatStride = (i32)sizeof(BenchmarkFatUnit);
+            const i32 streamStride = (i32)(sizeof(bool) + sizeof(glm::vec2) * 2);
+
+            ATTOINFO("Unit storage %d units x %d passes: integrate fat %f ms (%d bytes/unit), streams %f ms (%d bytes/unit)",
+                unitCount, passCount, fatIntegrateClock.GetElapsedMilliseconds(), fatStride, streamIntegrateClock.GetElapsedMilliseconds(), streamStride);
+            ATTOINFO("Unit storage %d units x %d passes: gather fat %f ms, streams %f ms (checksums %f / %f)",
+                unitCount, passCount, fatGatherClock.GetElapsedMilliseconds(), streamGatherClock.GetElapsedMilliseconds(), fatChecksum, streamChecksum);
+        }
+    }
+
+    void LeEngine::DEBUGBenchmarkPathfinding() {
+        const i32 gridSize = 256;
+        const i32 queryCount = 200;
+
+        // Scattered single tile blockers, about a quarter of the map
+        PathGrid grid;
+        grid.Create(gridSize, gridSize);
+        for (i32 y = 0; y < gridSize; y++) {
+            for (i32 x = 0; x < gridSize; x++) {
+                grid.SetWalkable(x, y, Random() > 0.25f);
+            }
+        }
+
+        AStarSearch search;
+        List<glm::ivec2> path;
+
+        // Short is roughly a move order across the screen, long is corner to corner
+        const i32 maxQueryDistances[] = { 24, gridSize };
+        for (i32 distanceIndex = 0; distanceIndex < (i32)(sizeof(maxQueryDistances) / sizeof(maxQueryDistances[0])); distanceIndex++) {
+            const i32 maxQueryDistance = maxQueryDistances[distanceIndex];
+
+            f64 totalMicroseconds = 0.0;
+            f64 maxMicroseconds = 0.0;
+            i32 totalExpanded = 0;
+            i32 foundCount = 0;
+            for (i32 queryIndex = 0; queryIndex < queryCount; queryIndex++) {
+                const glm::ivec2 start = glm::ivec2(RandomInt(0, gridSize - 1), RandomInt(0, gridSize - 1));
+                glm::ivec2 goal = start + glm::ivec2(RandomInt(-maxQueryDistance, maxQueryDistance), RandomInt(-maxQueryDistance, maxQueryDistance));
+                goal = glm::clamp(goal, glm::ivec2(0), glm::ivec2(gridSize - 1));
+
+                grid.SetWalkable(start.x, start.y, true);
+                grid.SetWalkable(goal.x, goal.y, true);
+
+                Clock clock;
+                clock.Start();
+                if (search.FindPath(grid, start, goal, path)) {
+                    foundCount++;
+                }
+                clock.End();
+
+                const f64 microseconds = clock.GetElapsedMicroseconds();
+                totalMicroseconds += microseconds;
+                maxMicroseconds = glm::max(maxMicroseconds, microseconds);
+                totalExpanded += search.GetExpandedCount();
+            }
+
+            ATTOINFO("A* %dx%d, goals within %d tiles: avg %f us, max %f us, avg %d expanded (%d / %d found)",
+                gridSize, gridSize, maxQueryDistance, totalMicroseconds / queryCount, maxMicroseconds, totalExpanded / queryCount, foundCount, queryCount);
+        }
+    }
+
+    void LeEngine::DEBUGBenchmarkHierarchicalPathfinding() {
+        const i32 gridSize = 512;
+        const i32 clusterSize = Map::PATH_CLUSTER_SIZE;
+        const i32 queryCount = 100;
+        const i32 updateCount = 100;
+
+        // Rectangular obstacles like buildings and cliffs, with some scattered single tile noise
+        PathGrid grid;
+        grid.Create(gridSize, gridSize);
+        for (i32 y = 0; y < gridSize; y++) {
+            for (i32 x = 0; x < gridSize; x++) {
+                grid.SetWalkable(x, y, Random() > 0.08f);
+            }
+        }
+
+        for (i32 obstacleIndex = 0; obstacleIndex < 300; obstacleIndex++) {
+            const glm::ivec2 min = glm::ivec2(RandomInt(0, gridSize - 1), RandomInt(0, gridSize - 1));
+            const glm::ivec2 max = glm::min(min + glm::ivec2(RandomInt(3, 32), RandomInt(3, 32)), glm::ivec2(gridSize - 1));
+            for (i32 y = min.y; y <= max.y; y++) {
+                for (i32 x = min.x; x <= max.x; x++) {
+                    grid.SetWalkable(x, y, false);
+                }
+            }
+        }
+
+        HierarchicalPathfinder hierarchy;
+        Clock buildClock;
+        buildClock.Start();
+        hierarchy.Build(&grid, clusterSize);
+        buildClock.End();
+
+        ATTOINFO("HPA* %dx%d, %d clusters, %d entrance nodes: build %f ms",
+            gridSize, gridSize, hierarchy.GetClusterCount(), hierarchy.GetNodeCount(), buildClock.GetElapsedMilliseconds());
+
+        AStarSearch search;
+        List<glm::ivec2> path;
+
+        f64 flatTotalMicroseconds = 0.0;
+        f64 flatMaxMicroseconds = 0.0;
+        f64 hierarchyTotalMicroseconds = 0.0;
+        f64 hierarchyMaxMicroseconds = 0.0;
+        f64 totalCostRatio = 0.0;
+        i32 flatFoundCount = 0;
+        i32 hierarchyFoundCount = 0;
+        i32 bothFoundCount = 0;
+        for (i32 queryIndex = 0; queryIndex < queryCount; queryIndex++) {
+            // Pick walkable tiles instead of clearing them so the hierarchy stays in sync with the grid
+            glm::ivec2 start = {};
+            glm::ivec2 goal = {};
+            do {
+                start = glm::ivec2(RandomInt(0, gridSize - 1), RandomInt(0, gridSize - 1));
+            } while (!grid.IsWalkable(start.x, start.y));
+            do {
+                goal = glm::ivec2(RandomInt(0, gridSize - 1), RandomInt(0, gridSize - 1));
+            } while (!grid.IsWalkable(goal.x, goal.y));
+
+            Clock flatClock;
+            flatClock.Start();
+            const bool flatFound = search.FindPath(grid, start, goal, path);
+            flatClock.End();
+
+            Clock hierarchyClock;
+            hierarchyClock.Start();
+            const bool hierarchyFound = hierarchy.FindPath(start, goal, path);
+            hierarchyClock.End();
+
+            const f64 flatMicroseconds = flatClock.GetElapsedMicroseconds();
+            const f64 hierarchyMicroseconds = hierarchyClock.GetElapsedMicroseconds();
+            flatTotalMicroseconds += flatMicroseconds;
+            flatMaxMicroseconds = glm::max(flatMaxMicroseconds, flatMicroseconds);
+            hierarchyTotalMicroseconds += hierarchyMicroseconds;
+            hierarchyMaxMicroseconds = glm::max(hierarchyMaxMicroseconds, hierarchyMicroseconds);
+
+            flatFoundCount += flatFound ? 1 : 0;
+            hierarchyFoundCount += hierarchyFound ? 1 : 0;
+            if (flatFound && hierarchyFound && search.GetPathCost() > 0) {
+                totalCostRatio += (f64)hierarchy.GetPathCost() / (f64)search.GetPathCost();
+                bothFoundCount++;
+            }
+        }
+
+        ATTOINFO("HPA* %dx%d, random pairs: A* avg %f us max %f us, HPA* avg %f us max %f us (%d / %d found)",
+            gridSize, gridSize, flatTotalMicroseconds / queryCount, flatMaxMicroseconds,
+            hierarchyTotalMicroseconds / queryCount, hierarchyMaxMicroseconds, hierarchyFoundCount, flatFoundCount);
+        ATTOINFO("HPA* %dx%d, path cost vs A*: %f avg", gridSize, gridSize, bothFoundCount > 0 ? totalCostRatio / bothFoundCount : 0.0);
+
+        f64 updateTotalMicroseconds = 0.0;
+        for (i32 updateIndex = 0; updateIndex < updateCount; updateIndex++) {
+            const i32 x = RandomInt(0, gridSize - 1);
+            const i32 y = RandomInt(0, gridSize - 1);
+            grid.SetWalkable(x, y, !grid.IsWalkable(x, y));
+
+            Clock updateClock;
+            updateClock.Start();
+            hierarchy.UpdateTile(x, y);
+            updateClock.End();
+
+            updateTotalMicroseconds += updateClock.GetElapsedMicroseconds();
+        }
+
+        ATTOINFO("HPA* %dx%d, single tile change: avg %f us", gridSize, gridSize, updateTotalMicroseconds / updateCount);
+    }
+
+    void LeEngine::DEBUGBenchmarkSpriteBuild() {
+        const i32 spriteCount = 16384;
+        const i32 passCount = 20;
+
+        SpriteAsset* spriteAsset = GetSpriteAsset(AssetId::Create("unit_basic_man"));
+        if (spriteAsset == nullptr || !DrawSpriteLoadTexture(spriteAsset)) {
+            ATTOINFO("Sprite build: no sprite to benchmark with");
+            return;
+        }
+
+        // Only the CPU side, building what would be uploaded
+        List<DrawSpriteCommand> commands;
+        commands.SetNum(spriteCount, true);
+        for (i32 commandIndex = 0; commandIndex < spriteCount; commandIndex++) {
+            DrawSpriteCommand cmd = DrawSpriteCreateCommand();
+            cmd.spriteAsset = spriteAsset;
+            cmd.position = glm::vec2(Random(-2000.0f, 2000.0f), Random(-2000.0f, 2000.0f));
+            cmd.rotation = Random(0.0f, 6.28f);
+            cmd.frameIndex = RandomInt(0, glm::max(spriteAsset->frameCount - 1, 0));
+            commands[commandIndex] = cmd;
+        }
+
+        List<SpriteVertex> vertices;
+        List<SpriteInstanceVertex> instances;
+        List<SpriteBatch> batches;
+        vertices.SetNum(spriteCount * SpriteRenderingState::VERTICES_PER_SPRITE, true);
+        instances.SetNum(spriteCount, true);
+
+        i32 vertexCount = 0;
+        Clock verticesClock;
+        verticesClock.Start();
+        for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+            vertexCount = DrawSpriteBuildVertices(commands.GetData(), spriteCount, vertices.GetData(), batches);
+        }
+        verticesClock.End();
+
+        i32 instanceCount = 0;
+        Clock instancesClock;
+        instancesClock.Start();
+        for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+            instanceCount = DrawSpriteBuildInstances(commands.GetData(), spriteCount, instances.GetData(), batches);
+        }
+        instancesClock.End();
+
+        ATTOINFO("Sprite build %d sprites: batched %f us (%d bytes), instanced %f us (%d bytes)",
+            spriteCount, verticesClock.GetElapsedMicroseconds() / passCount, vertexCount * (i32)sizeof(SpriteVertex),
+            instancesClock.GetElapsedMicroseconds() / passCount, instanceCount * (i32)sizeof(SpriteInstanceVertex));
+    }
+
+    void LeEngine::DEBUGBenchmarkSpriteQuadKernel() {
+        const i32 spriteCount = 16384;
+        const i32 passCount = 20;
+        const u32 color = 0xFFFFFFFF;
+
+        // Half the sprites unrotated like blockers and units, half spun like debris
+        SpriteQuadStreams streams;
+        streams.SetCount(spriteCount);
+        for (i32 spriteIndex = 0; spriteIndex < spriteCount; spriteIndex++) {
+            const f32 w = (f32)RandomInt(8, 64);
+            const f32 h = (f32)RandomInt(8, 64);
+            streams.positionX[spriteIndex] = Random(-2000.0f, 2000.0f);
+            streams.positionY[spriteIndex] = Random(-2000.0f, 2000.0f);
+            streams.rotation[spriteIndex] = spriteIndex < spriteCount / 2 ? 0.0f : Random(0.0f, 6.28f);
+            streams.width[spriteIndex] = w;
+            streams.height[spriteIndex] = h;
+            streams.originX[spriteIndex] = -w / 2.0f;
+            streams.originY[spriteIndex] = -h / 2.0f;
+            streams.u0[spriteIndex] = Random(0.0f, 0.5f);
+            streams.v0[spriteIndex] = Random(0.0f, 0.5f);
+            streams.u1[spriteIndex] = Random(0.5f, 1.0f);
+            streams.v1[spriteIndex] = Random(0.5f, 1.0f);
+        }
+
+        List<SpriteVertex> kernelVertices;
+        List<SpriteVertex> scalarVertices;
+        kernelVertices.SetNum(spriteCount * SpriteRenderingState::VERTICES_PER_SPRITE, true);
+        scalarVertices.SetNum(spriteCount * SpriteRenderingState::VERTICES_PER_SPRITE, true);
+
+        Clock kernelClock;
+        kernelClock.Start();
+        for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+            SpriteQuadKernel::Expand(streams, spriteCount, color, kernelVertices.GetData());
+        }
+        kernelClock.End();
+
+        Clock scalarClock;
+        scalarClock.Start();
+        for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+            SpriteQuadKernel::ExpandScalar(streams, 0, spriteCount, color, scalarVertices.GetData());
+        }
+        scalarClock.End();
+
+        // In fixed point steps, the two only round ties differently so anything past one step is a kernel bug
+        i32 maxError = 0;
+        for (i32 vertexIndex = 0; vertexIndex < kernelVertices.GetNum(); vertexIndex++) {
+            const SpriteVertex& a = kernelVertices[vertexIndex];
+            const SpriteVertex& b = scalarVertices[vertexIndex];
+            for (i32 component = 0; component < 2; component++) {
+                maxError = glm::max(maxError, glm::abs((i32)a.position[component] - (i32)b.position[component]));
+                maxError = glm::max(maxError, glm::abs((i32)a.uv[component] - (i32)b.uv[component]));
+            }
+        }
+
+        const f64 kernelSeconds = kernelClock.GetElapsedMicroseconds() / 1000000.0;
+        const f64 scalarSeconds = scalarClock.GetElapsedMicroseconds() / 1000000.0;
+        ATTOINFO("Sprite quad kernel %d sprites: kernel %f sprites/s, scalar %f sprites/s (max error %d)",
+            spriteCount, (f64)spriteCount * passCount / kernelSeconds, (f64)spriteCount * passCount / scalarSeconds, maxError);
+        Assert(maxError <= 1, "SpriteQuadKernel::Expand doesn't match ExpandScalar");
+    }
+
+    void LeEngine::DEBUGBenchmarkSpriteSort() {
+        const i32 commandCounts[] = { 1000, 10000, 100000 };
+        const i32 maxCommandCount = 100000;
+
+        SpriteAsset* spriteAssets[] = {
+            GetSpriteAsset(AssetId::Create("tile_blocker")),
+            GetSpriteAsset(AssetId::Create("unit_basic_man")),
+            GetSpriteAsset(AssetId::Create("unit_basic_man_enemy")),
+        };
+
+        List<DrawSpriteCommand> commands;
+        List<DrawSpriteCommand> sortedCommands;
+        List<u64> keys;
+        List<i32> indices;
+        List<u64> scratchKeys;
+        List<i32> scratchIndices;
+        commands.SetNum(maxCommandCount, true);
+        sortedCommands.SetNum(maxCommandCount, true);
+        keys.SetNum(maxCommandCount, true);
+        indices.SetNum(maxCommandCount, true);
+        scratchKeys.SetNum(maxCommandCount, true);
+        scratchIndices.SetNum(maxCommandCount, true);
+
+        for (i32 countIndex = 0; countIndex < (i32)(sizeof(commandCounts) / sizeof(commandCounts[0])); countIndex++) {
+            const i32 commandCount = commandCounts[countIndex];
+
+            // A world layer spread over a map a few screens across, like blockers and units
+            for (i32 commandIndex = 0; commandIndex < commandCount; commandIndex++) {
+                DrawSpriteCommand cmd = DrawSpriteCreateCommand();
+                cmd.spriteAsset = spriteAssets[RandomInt(0, 2)];
+                cmd.position = glm::vec2(Random(-4000.0f, 4000.0f), Random(-4000.0f, 0.0f));
+                cmd.sortKey = DrawSpriteMakeSortKey(SPRITE_LAYER_WORLD, cmd.position, cmd.spriteAsset);
+                commands[commandIndex] = cmd;
+            }
+
+            std::memcpy(sortedCommands.GetData(), commands.GetData(), commandCount * sizeof(DrawSpriteCommand));
+            Clock qsortClock;
+            qsortClock.Start();
+            qsort(sortedCommands.GetData(), commandCount, sizeof(DrawSpriteCommand), BenchmarkCompareSpriteSortKey);
+            qsortClock.End();
+
+            // Same as DrawSpriteSortCommands, keys and indices are sorted and then each command moves once
+            Clock radixClock;
+            radixClock.Start();
+            for (i32 commandIndex = 0; commandIndex < commandCount; commandIndex++) {
+                keys[commandIndex] = commands[commandIndex].sortKey;
+                indices[commandIndex] = commandIndex;
+            }
+
+            Sorting::RadixSort64(keys.GetData(), indices.GetData(), scratchKeys.GetData(), scratchIndices.GetData(), commandCount);
+
+            for (i32 sortedIndex = 0; sortedIndex < commandCount; sortedIndex++) {
+                sortedCommands[sortedIndex] = commands[indices[sortedIndex]];
+            }
+            radixClock.End();
+
+            bool isSorted = true;
+            for (i32 sortedIndex = 1; sortedIndex < commandCount; sortedIndex++) {
+                isSorted = isSorted && sortedCommands[sortedIndex - 1].sortKey <= sortedCommands[sortedIndex].sortKey;
+            }
+
+            ATTOINFO("Sprite sort %d commands: qsort %f us, radix %f us (%s)",
+                commandCount, qsortClock.GetElapsedMicroseconds(), radixClock.GetElapsedMicroseconds(), isSorted ? "sorted" : "NOT SORTED");
+        }
+    }
+
+    void LeEngine::DEBUGCheckSpriteAnimation() {
+        // None of the shipped sprites animate, so this is what covers EntitySprite::StepAnimation. Frame duration
+        // and step are powers of two so the playhead is exact and every step lands where it's expected to.
+        const i32 frameCount = 4;
+        const f32 frameDuration = 0.25f;
+        const f32 dt = 0.125f;
+
+        SpriteAsset sprite = SpriteAsset::CreateDefault();
+        sprite.frameCount = frameCount;
+        sprite.frameDuration = frameDuration;
+        sprite.animated = true;
+        for (i32 frameIndex = 0; frameIndex < frameCount; frameIndex++) {
+            sprite.frameUVs.Add(glm::vec4((f32)frameIndex / frameCount, 0.0f, (f32)(frameIndex + 1) / frameCount, 1.0f));
+        }
+
+        EntitySprite entitySprite = {};
+        entitySprite.active = true;
+        entitySprite.sprite = &sprite;
+
+        bool passed = true;
+        bool wrapped = false;
+        for (i32 stepIndex = 1; stepIndex <= frameCount * 4; stepIndex++) {
+            const i32 previousFrameIndex = entitySprite.currentFrameIndex;
+            entitySprite.StepAnimation(dt);
+
+            const i32 expectedFrameIndex = (stepIndex / 2) % frameCount;
+            passed = passed && entitySprite.currentFrameIndex == expectedFrameIndex;
+            wrapped = wrapped || (previousFrameIndex == frameCount - 1 && entitySprite.currentFrameIndex == 0);
+        }
+
+        passed = passed && wrapped && entitySprite.animationDuration == frameDuration * frameCount;
+
+        // A playhead a hair under the duration has to stay on the last frame
+        entitySprite.animationPlayhead = std::nextafter(entitySprite.animationDuration, 0.0f);
+        entitySprite.StepAnimation(0.0f);
+        passed = passed && entitySprite.currentFrameIndex == frameCount - 1;
+
+        ATTOINFO("Sprite animation %d frames: %s", frameCount, passed ? "steps and wraps" : "FAILED");
+        Assert(passed, "EntitySprite::StepAnimation picked the wrong frame");
+    }
+}
@@ -213,6 +213,72 @@ namespace atto
         return true;
     }
 
+    bool CollisionTests::CirclePoly(const Circle& circle, const BakedPolygonCollider& poly, Manifold& manifold) {
+        f32 depth = REAL_MAX;
+        glm::vec2 normal = {};
+
+        const i32 vertexCount = poly.vertices.GetCount();
+        for (i32 i = 0; i < vertexCount; i++) {
+            const glm::vec2 axis = poly.normals[i];
+            const f32 minA = poly.extents[i].x;
+            const f32 maxA = poly.extents[i].y;
+
+            // Axis is unit length so the circle projects to its center +/- radius
+            const f32 circleCenter = glm::dot(circle.pos, axis);
+            const f32 minB = circleCenter - circle.rad;
+            const f32 maxB = circleCenter + circle.rad;
+
+            if (minA >= maxB || minB >= maxA) {
+                return false;
+            }
+
+            const f32 axisDepth = glm::min(maxB - minA, maxA - minB);
+            if (axisDepth < depth) {
+                depth = axisDepth;
+                normal = axis;
+            }
+        }
+
+        f32 minDistance = REAL_MAX;
+        glm::vec2 cp = {};
+        for (i32 i = 0; i < vertexCount; i++) {
+            const f32 distance = glm::distance2(poly.vertices[i], circle.pos);
+            if (distance < minDistance) {
+                minDistance = distance;
+                cp = poly.vertices[i];
+            }
+        }
+
+        const glm::vec2 axis = glm::normalize(cp - circle.pos);
+
+        f32 minA = 0;
+        f32 maxA = 0;
+        ProjectVertices(poly.vertices.GetData(), vertexCount, axis, minA, maxA);
+
+        const f32 circleCenter = glm::dot(circle.pos, axis);
+        const f32 minB = circleCenter - circle.rad;
+        const f32 maxB = circleCenter + circle.rad;
+
+        if (minA >= maxB || minB >= maxA) {
+            return false;
+        }
+
+        const f32 axisDepth = glm::min(maxB - minA, maxA - minB);
+        if (axisDepth < depth) {
+            depth = axisDepth;
+            normal = axis;
+        }
+
+        if (glm::dot(poly.centroid - circle.pos, normal) < 0.0f) {
+            normal = -normal;
+        }
+
+        manifold.normal = normal;
+        manifold.penetration = depth;
+
+        return true;
+    }
+
     inline static f32 Determinant(glm::vec2 u, glm::vec2 v) {
         f32 result = u.x * v.y - u.y * v.x;
         return result;
@@ -237,6 +303,35 @@ namespace atto
         }
     }
 
+    void BakedPolygonCollider::Bake(const PolygonCollider& poly) {
+        vertices = poly.vertices;
+        normals.Clear();
+        extents.Clear();
+        centroid = glm::vec2(0.0f, 0.0f);
+
+        const i32 count = vertices.GetCount();
+        for (i32 i = 0; i < count; ++i) {
+            centroid += vertices[i];
+        }
+        centroid /= (f32)count;
+
+        for (i32 i = 0; i < count; ++i) {
+            const glm::vec2 edge = vertices[(i + 1) % count] - vertices[i];
+            const glm::vec2 normal = glm::normalize(glm::vec2(-edge.y, edge.x));
+
+            f32 min = REAL_MAX;
+            f32 max = REAL_MIN;
+            for (i32 j = 0; j < count; ++j) {
+                const f32 proj = glm::dot(vertices[j], normal);
+                min = glm::min(min, proj);
+                max = glm::max(max, proj);
+            }
+
+            normals.Add(normal);
+            extents.Add(glm::vec2(min, max));
+        }
+    }
+
     static i32 CompareVerticesClockwise(void* context, const void* a, const void* b) {
         const glm::vec2* va = static_cast<const glm::vec2*>(a);
         const glm::vec2* vb = static_cast<const glm::vec2*>(b);
@@ -311,4 +406,55 @@ namespace atto
         return outVertexIndex;
     }
 
+    void Sorting::RadixSort64(u64* keys, i32* values, u64* scratchKeys, i32* scratchValues, i32 count) {
+        const i32 passCount = 8;
+        const i32 bucketCount = 256;
+
+        // All the histograms in one go so the keys are only read once for counting
+        i32 histograms[passCount][bucketCount] = {};
+        for (i32 i = 0; i < count; i++) {
+            const u64 key = keys[i];
+            for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+                histograms[passIndex][(key >> (passIndex * 8)) & 0xFF]++;
+            }
+        }
+
+        u64* sourceKeys = keys;
+        i32* sourceValues = values;
+        u64* destKeys = scratchKeys;
+        i32* destValues = scratchValues;
+
+        for (i32 passIndex = 0; passIndex < passCount; passIndex++) {
+            i32* histogram = histograms[passIndex];
+            const i32 shift = passIndex * 8;
+
+            // Every key lands in the same bucket, the pass wouldn't move anything
+            if (count == 0 || histogram[(sourceKeys[0] >> shift) & 0xFF] == count) {
+                continue;
+            }
+
+            i32 offset = 0;
+            for (i32 bucketIndex = 0; bucketIndex < bucketCount; bucketIndex++) {
+                const i32 bucketSize = histogram[bucketIndex];
+                histogram[bucketIndex] = offset;
+                offset += bucketSize;
+            }
+
+            for (i32 i = 0; i < count; i++) {
+                const u64 key = sourceKeys[i];
+                const i32 writeIndex = histogram[(key >> shift) & 0xFF]++;
+                destKeys[writeIndex] = key;
+                destValues[writeIndex] = sourceValues[i];
+            }
+
+            Swap(sourceKeys, destKeys);
+            Swap(sourceValues, destValues);
+        }
+
+        // An odd number of passes leaves the result in the scratch buffers
+        if (sourceKeys != keys) {
+            std::memcpy(keys, sourceKeys, count * sizeof(u64));
+            std::memcpy(values, sourceValues, count * sizeof(i32));
+        }
+    }
 }
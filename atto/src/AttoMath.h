@@ -56,6 +56,16 @@ namespace atto
         void                   Translate(const glm::vec2& translation);
     };
 
+    // SAT data for a polygon that never moves, so none of it has to be recomputed per test
+    struct BakedPolygonCollider {
+        FixedList<glm::vec2, 8> vertices;   // World space
+        FixedList<glm::vec2, 8> normals;    // Unit edge normals
+        FixedList<glm::vec2, 8> extents;    // Min (x) and max (y) projection of the vertices onto each normal
+        glm::vec2               centroid;
+
+        void                    Bake(const PolygonCollider& poly);
+    };
+
     struct BoxBounds {
         glm::vec2 min;
         glm::vec2 max;
@@ -78,6 +88,7 @@ namespace atto
     public:
 
         static bool CirclePoly(const Circle& circle, const PolygonCollider& poly, Manifold& manifold);
+        static bool CirclePoly(const Circle& circle, const BakedPolygonCollider& poly, Manifold& manifold);
         static glm::vec2 ClosestVertexOnPoly(const PolygonCollider& poly, const glm::vec2& point);
     private:
         static void ProjectVertices(const glm::vec2* vertices, i32 verticesCount, glm::vec2 axis, f32& min, f32& max);
@@ -89,4 +100,158 @@ namespace atto
         static void SortPointsIntoClockWiseOrder(glm::vec2* vertices, i32 verticesCount);
         static i32  Triangulate(PolygonCollider poly, glm::vec2* outVertices, i32 outVerticesCapcity);
     };
+
+    class Sorting {
+    public:
+        // Stable LSD radix sort on 64 bit keys, 8 bits a pass, values move with their keys. Passes where every
+        // key has the same byte are skipped. The scratch buffers need room for count elements.
+        static void RadixSort64(u64* keys, i32* values, u64* scratchKeys, i32* scratchValues, i32 count);
+    };
+
+    // Uniform grid hashed into a fixed number of buckets. Rebuilt from scratch with Begin/Insert/End,
+    // End does a counting sort so each bucket is a contiguous run of values.
+    template<i32 capcity>
+    class SpatialHashGrid {
+    public:
+        static const i32 BUCKET_COUNT = 4096; // Must be a power of 2
+
+        void            Begin(f32 cellSize);
+        void            Insert(i32 value, glm::vec2 pos);
+        void            End();
+
+        i32             GetCount() const;
+        f32             GetCellSize() const;
+        glm::ivec2      GetCell(glm::vec2 pos) const;
+
+        // Calls func(value) for every value whose cell overlaps the given box
+        template<typename _func_>
+        void            Query(glm::vec2 min, glm::vec2 max, _func_ func) const;
+
+        // Calls func(value) for every value whose cell overlaps the given circle
+        template<typename _func_>
+        void            QueryRadius(glm::vec2 center, f32 radius, _func_ func) const;
+
+    private:
+        static u32      HashCell(glm::ivec2 cell);
+
+        template<typename _func_>
+        void            VisitCell(glm::ivec2 cell, _func_& func) const;
+
+        f32             cellSize;
+        f32             invCellSize;
+        i32             count;
+        i32             values[capcity];
+        glm::ivec2      cells[capcity];
+        u32             buckets[capcity];
+        i32             sortedValues[capcity];
+        glm::ivec2      sortedCells[capcity];
+        i32             bucketStarts[BUCKET_COUNT + 1];
+    };
+
+    template<i32 capcity>
+    void SpatialHashGrid<capcity>::Begin(f32 cellSize) {
+        Assert(cellSize > 0.0f, "SpatialHashGrid, invalid cell size");
+        this->cellSize = cellSize;
+        this->invCellSize = 1.0f / cellSize;
+        this->count = 0;
+    }
+
+    template<i32 capcity>
+    void SpatialHashGrid<capcity>::Insert(i32 value, glm::vec2 pos) {
+        Assert(count < capcity, "SpatialHashGrid, to many values");
+        const glm::ivec2 cell = GetCell(pos);
+        values[count] = value;
+        cells[count] = cell;
+        buckets[count] = HashCell(cell);
+        count++;
+    }
+
+    template<i32 capcity>
+    void SpatialHashGrid<capcity>::End() {
+        std::memset(bucketStarts, 0, sizeof(bucketStarts));
+        for (i32 i = 0; i < count; i++) {
+            bucketStarts[buckets[i] + 1]++;
+        }
+
+        for (i32 bucketIndex = 0; bucketIndex < BUCKET_COUNT; bucketIndex++) {
+            bucketStarts[bucketIndex + 1] += bucketStarts[bucketIndex];
+        }
+
+        // Use the starts as write cursors, this leaves each start pointing at the next bucket's start...
+        for (i32 i = 0; i < count; i++) {
+            const i32 writeIndex = bucketStarts[buckets[i]]++;
+            sortedValues[writeIndex] = values[i];
+            sortedCells[writeIndex] = cells[i];
+        }
+
+        // ... so shift them back by one bucket
+        for (i32 bucketIndex = BUCKET_COUNT; bucketIndex > 0; bucketIndex--) {
+            bucketStarts[bucketIndex] = bucketStarts[bucketIndex - 1];
+        }
+        bucketStarts[0] = 0;
+    }
+
+    template<i32 capcity>
+    i32 SpatialHashGrid<capcity>::GetCount() const {
+        return count;
+    }
+
+    template<i32 capcity>
+    f32 SpatialHashGrid<capcity>::GetCellSize() const {
+        return cellSize;
+    }
+
+    template<i32 capcity>
+    glm::ivec2 SpatialHashGrid<capcity>::GetCell(glm::vec2 pos) const {
+        return glm::ivec2((i32)floorf(pos.x * invCellSize), (i32)floorf(pos.y * invCellSize));
+    }
+
+    template<i32 capcity>
+    template<typename _func_>
+    void SpatialHashGrid<capcity>::Query(glm::vec2 min, glm::vec2 max, _func_ func) const {
+        const glm::ivec2 minCell = GetCell(min);
+        const glm::ivec2 maxCell = GetCell(max);
+        for (i32 y = minCell.y; y <= maxCell.y; y++) {
+            for (i32 x = minCell.x; x <= maxCell.x; x++) {
+                VisitCell(glm::ivec2(x, y), func);
+            }
+        }
+    }
+
+    template<i32 capcity>
+    template<typename _func_>
+    void SpatialHashGrid<capcity>::QueryRadius(glm::vec2 center, f32 radius, _func_ func) const {
+        const glm::ivec2 minCell = GetCell(center - glm::vec2(radius));
+        const glm::ivec2 maxCell = GetCell(center + glm::vec2(radius));
+        const f32 radiusSqrd = radius * radius;
+        for (i32 y = minCell.y; y <= maxCell.y; y++) {
+            for (i32 x = minCell.x; x <= maxCell.x; x++) {
+                // Skip the cells in the corners of the box that the circle doesn't reach
+                const glm::vec2 cellMin = glm::vec2((f32)x, (f32)y) * cellSize;
+                const glm::vec2 closest = glm::clamp(center, cellMin, cellMin + glm::vec2(cellSize));
+                if (glm::distance2(center, closest) <= radiusSqrd) {
+                    VisitCell(glm::ivec2(x, y), func);
+                }
+            }
+        }
+    }
+
+    template<i32 capcity>
+    template<typename _func_>
+    void SpatialHashGrid<capcity>::VisitCell(glm::ivec2 cell, _func_& func) const {
+        const u32 bucket = HashCell(cell);
+        const i32 end = bucketStarts[bucket + 1];
+        for (i32 i = bucketStarts[bucket]; i < end; i++) {
+            // Different cells can share a bucket, only visit the ones actually in this cell
+            if (sortedCells[i] == cell) {
+                func(sortedValues[i]);
+            }
+        }
+    }
+
+    template<i32 capcity>
+    u32 SpatialHashGrid<capcity>::HashCell(glm::ivec2 cell) {
+        const u32 h = ((u32)cell.x * 73856093u) ^ ((u32)cell.y * 19349663u);
+        return h & (BUCKET_COUNT - 1);
+    }
 }
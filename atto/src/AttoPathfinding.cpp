@@ -0,0 +1,734 @@
+#include "AttoPathfinding.h"
+
+namespace atto
+{
+    static const glm::ivec2 directionOffsets[PathGrid::DIRECTION_COUNT] = {
+        glm::ivec2(0, 1), glm::ivec2(0, -1), glm::ivec2(-1, 0), glm::ivec2(1, 0),
+        glm::ivec2(-1, 1), glm::ivec2(1, 1), glm::ivec2(-1, -1), glm::ivec2(1, -1),
+    };
+
+    void PathGrid::Create(i32 width, i32 height) {
+        this->width = width;
+        this->height = height;
+        this->stride = width + 2;
+
+        const i32 cellCount = stride * (height + 2);
+        cells.SetNum(cellCount);
+        for (i32 cellIndex = 0; cellIndex < cellCount; cellIndex++) {
+            cells[cellIndex] = 0;
+        }
+
+        for (i32 direction = 0; direction < DIRECTION_COUNT; direction++) {
+            const glm::ivec2 offset = directionOffsets[direction];
+            neighborOffsets[direction] = offset.y * stride + offset.x;
+
+            // A diagonal step needs both orthogonal cells it passes between to be open
+            cornerOffsets[direction][0] = offset.x;
+            cornerOffsets[direction][1] = offset.y * stride;
+        }
+    }
+
+    void PathGrid::SetWalkable(i32 x, i32 y, bool walkable) {
+        Assert(x >= 0 && x < width && y >= 0 && y < height, "PathGrid, invalid tile");
+        cells[GetCellIndex(x, y)] = walkable ? 1 : 0;
+    }
+
+    bool PathGrid::IsWalkable(i32 x, i32 y) const {
+        if (x < 0 || x >= width || y < 0 || y >= height) {
+            return false;
+        }
+
+        return cells[GetCellIndex(x, y)] != 0;
+    }
+
+    i32 PathGrid::GetWidth() const {
+        return width;
+    }
+
+    i32 PathGrid::GetHeight() const {
+        return height;
+    }
+
+    i32 PathGrid::GetCellCount() const {
+        return cells.GetNum();
+    }
+
+    i32 PathGrid::GetCellIndex(i32 x, i32 y) const {
+        return (y + 1) * stride + (x + 1);
+    }
+
+    glm::ivec2 PathGrid::GetCellPos(i32 cellIndex) const {
+        return glm::ivec2(cellIndex % stride - 1, cellIndex / stride - 1);
+    }
+
+    bool PathGrid::IsCellWalkable(i32 cellIndex) const {
+        return cells[cellIndex] != 0;
+    }
+
+    i32 PathGrid::GetNeighbor(i32 cellIndex, i32 direction) const {
+        const i32 neighborIndex = cellIndex + neighborOffsets[direction];
+        if (cells[neighborIndex] == 0) {
+            return -1;
+        }
+
+        if (direction >= 4) {
+            if (cells[cellIndex + cornerOffsets[direction][0]] == 0 || cells[cellIndex + cornerOffsets[direction][1]] == 0) {
+                return -1;
+            }
+        }
+
+        return neighborIndex;
+    }
+
+    i32 PathGrid::GetDirectionCost(i32 direction) {
+        return direction < 4 ? PATH_COST_ORTHOGONAL : PATH_COST_DIAGONAL;
+    }
+
+    glm::ivec2 PathGrid::GetDirectionOffset(i32 direction) {
+        return directionOffsets[direction];
+    }
+
+    bool AStarSearch::FindPath(const PathGrid& grid, glm::ivec2 start, glm::ivec2 goal, List<glm::ivec2>& outPath) {
+        return FindPath(grid, start, goal, glm::ivec2(0, 0), glm::ivec2(grid.GetWidth() - 1, grid.GetHeight() - 1), outPath);
+    }
+
+    bool AStarSearch::FindPath(const PathGrid& grid, glm::ivec2 start, glm::ivec2 goal, glm::ivec2 boundsMin, glm::ivec2 boundsMax, List<glm::ivec2>& outPath) {
+        outPath.SetNum(0, false);
+        pathCost = 0;
+        expandedCount = 0;
+
+        if (!grid.IsWalkable(start.x, start.y) || !grid.IsWalkable(goal.x, goal.y)) {
+            return false;
+        }
+
+        // Nodes are only ever cleared when the grid changes size or the generation wraps
+        const i32 cellCount = grid.GetCellCount();
+        generation++;
+        if (nodes.GetNum() != cellCount || generation == 0) {
+            nodes.SetNum(cellCount);
+            for (i32 cellIndex = 0; cellIndex < cellCount; cellIndex++) {
+                nodes[cellIndex].generation = 0;
+            }
+            generation = 1;
+        }
+
+        openList.Clear();
+        Node* nodeData = nodes.GetData();
+
+        const i32 startIndex = grid.GetCellIndex(start.x, start.y);
+        const i32 goalIndex = grid.GetCellIndex(goal.x, goal.y);
+
+        Node& startNode = nodeData[startIndex];
+        startNode.generation = generation;
+        startNode.g = 0;
+        startNode.parent = -1;
+        startNode.closed = false;
+        openList.Push({ PathOctileDistance(start, goal), 0, startIndex });
+
+        bool pathFound = false;
+        while (!openList.IsEmpty()) {
+            const PathOpenList::Entry entry = openList.Pop();
+            Node& node = nodeData[entry.index];
+
+            // Stale entries are left in the heap instead of decreasing keys, skip them here
+            if (node.closed || entry.g != node.g) {
+                continue;
+            }
+
+            node.closed = true;
+            expandedCount++;
+
+            if (entry.index == goalIndex) {
+                pathFound = true;
+                break;
+            }
+
+            const glm::ivec2 nodePos = grid.GetCellPos(entry.index);
+            for (i32 direction = 0; direction < PathGrid::DIRECTION_COUNT; direction++) {
+                const i32 neighborIndex = grid.GetNeighbor(entry.index, direction);
+                if (neighborIndex == -1) {
+                    continue;
+                }
+
+                const glm::ivec2 neighborPos = nodePos + directionOffsets[direction];
+                if (neighborPos.x < boundsMin.x || neighborPos.x > boundsMax.x || neighborPos.y < boundsMin.y || neighborPos.y > boundsMax.y) {
+                    continue;
+                }
+
+                const i32 g = node.g + PathGrid::GetDirectionCost(direction);
+                Node& neighbor = nodeData[neighborIndex];
+                if (neighbor.generation != generation) {
+                    neighbor.generation = generation;
+                    neighbor.closed = false;
+                }
+                else if (neighbor.closed || g >= neighbor.g) {
+                    continue;
+                }
+
+                neighbor.g = g;
+                neighbor.parent = entry.index;
+                openList.Push({ g + PathOctileDistance(neighborPos, goal), g, neighborIndex });
+            }
+        }
+
+        if (!pathFound) {
+            return false;
+        }
+
+        pathCost = nodes[goalIndex].g;
+
+        for (i32 cellIndex = goalIndex; cellIndex != -1; cellIndex = nodes[cellIndex].parent) {
+            outPath.Add(grid.GetCellPos(cellIndex));
+        }
+
+        const i32 pathLength = outPath.GetNum();
+        for (i32 i = 0; i < pathLength / 2; i++) {
+            Swap(outPath[i], outPath[pathLength - 1 - i]);
+        }
+
+        return true;
+    }
+
+    i32 AStarSearch::GetPathCost() const {
+        return pathCost;
+    }
+
+    i32 AStarSearch::GetExpandedCount() const {
+        return expandedCount;
+    }
+
+    void PathOpenList::Clear() {
+        heap.SetNum(0, false);
+    }
+
+    bool PathOpenList::IsEmpty() const {
+        return heap.GetNum() == 0;
+    }
+
+    bool PathOpenList::Less(const Entry& a, const Entry& b) {
+        // Ties go to the deeper node, it's closer to the goal
+        return a.f < b.f || (a.f == b.f && a.g > b.g);
+    }
+
+    void PathOpenList::Push(const Entry& entry) {
+        i32 index = heap.Add(entry);
+        Entry* entries = heap.GetData();
+        while (index > 0) {
+            const i32 parentIndex = (index - 1) / 2;
+            if (!Less(entries[index], entries[parentIndex])) {
+                break;
+            }
+
+            Swap(entries[index], entries[parentIndex]);
+            index = parentIndex;
+        }
+    }
+
+    PathOpenList::Entry PathOpenList::Pop() {
+        Entry* entries = heap.GetData();
+        const Entry result = entries[0];
+        const i32 count = heap.GetNum() - 1;
+        entries[0] = entries[count];
+        heap.SetNum(count, false);
+
+        i32 index = 0;
+        while (true) {
+            const i32 leftIndex = index * 2 + 1;
+            const i32 rightIndex = leftIndex + 1;
+            i32 smallestIndex = index;
+
+            if (leftIndex < count && Less(entries[leftIndex], entries[smallestIndex])) {
+                smallestIndex = leftIndex;
+            }
+
+            if (rightIndex < count && Less(entries[rightIndex], entries[smallestIndex])) {
+                smallestIndex = rightIndex;
+            }
+
+            if (smallestIndex == index) {
+                break;
+            }
+
+            Swap(entries[index], entries[smallestIndex]);
+            index = smallestIndex;
+        }
+
+        return result;
+    }
+
+    void HierarchicalPathfinder::Build(const PathGrid* grid, i32 clusterSize) {
+        this->grid = grid;
+        this->clusterSize = clusterSize;
+        clustersWide = (grid->GetWidth() + clusterSize - 1) / clusterSize;
+        clustersHigh = (grid->GetHeight() + clusterSize - 1) / clusterSize;
+
+        nodes.SetNum(0, false);
+        freeNodes.SetNum(0, false);
+        clusters.SetNum(clustersWide * clustersHigh);
+
+        for (i32 clusterY = 0; clusterY < clustersHigh; clusterY++) {
+            for (i32 clusterX = 0; clusterX < clustersWide; clusterX++) {
+                Cluster& cluster = clusters[clusterY * clustersWide + clusterX];
+                cluster.min = glm::ivec2(clusterX * clusterSize, clusterY * clusterSize);
+                cluster.max.x = glm::min(cluster.min.x + clusterSize - 1, grid->GetWidth() - 1);
+                cluster.max.y = glm::min(cluster.min.y + clusterSize - 1, grid->GetHeight() - 1);
+                cluster.nodes.SetNum(0, false);
+                cluster.costs.SetNum(0, false);
+            }
+        }
+
+        for (i32 clusterY = 0; clusterY < clustersHigh; clusterY++) {
+            for (i32 clusterX = 0; clusterX < clustersWide; clusterX++) {
+                const i32 clusterIndex = clusterY * clustersWide + clusterX;
+                if (clusterX + 1 < clustersWide) {
+                    BuildBorder(clusterIndex, clusterIndex + 1);
+                }
+
+                if (clusterY + 1 < clustersHigh) {
+                    BuildBorder(clusterIndex, clusterIndex + clustersWide);
+                }
+            }
+        }
+
+        const i32 clusterCount = clusters.GetNum();
+        for (i32 clusterIndex = 0; clusterIndex < clusterCount; clusterIndex++) {
+            BuildClusterEdges(clusterIndex);
+        }
+
+        searchGeneration = 0;
+        searchNodes.SetNum(0, false);
+    }
+
+    void HierarchicalPathfinder::UpdateTile(i32 x, i32 y) {
+        const i32 clusterX = x / clusterSize;
+        const i32 clusterY = y / clusterSize;
+        const i32 clusterIndex = clusterY * clustersWide + clusterX;
+
+        // The tile can change the entrances on any of its cluster's borders and so the nodes of the neighbors too
+        FixedList<i32, 5> touchedClusters = {};
+        touchedClusters.Add(clusterIndex);
+
+        if (clusterX > 0) {
+            RemoveBorder(clusterIndex - 1, clusterIndex);
+            BuildBorder(clusterIndex - 1, clusterIndex);
+            touchedClusters.Add(clusterIndex - 1);
+        }
+
+        if (clusterX + 1 < clustersWide) {
+            RemoveBorder(clusterIndex, clusterIndex + 1);
+            BuildBorder(clusterIndex, clusterIndex + 1);
+            touchedClusters.Add(clusterIndex + 1);
+        }
+
+        if (clusterY > 0) {
+            RemoveBorder(clusterIndex - clustersWide, clusterIndex);
+            BuildBorder(clusterIndex - clustersWide, clusterIndex);
+            touchedClusters.Add(clusterIndex - clustersWide);
+        }
+
+        if (clusterY + 1 < clustersHigh) {
+            RemoveBorder(clusterIndex, clusterIndex + clustersWide);
+            BuildBorder(clusterIndex, clusterIndex + clustersWide);
+            touchedClusters.Add(clusterIndex + clustersWide);
+        }
+
+        for (i32 touchedIndex = 0; touchedIndex < touchedClusters.GetCount(); touchedIndex++) {
+            BuildClusterEdges(touchedClusters[touchedIndex]);
+        }
+    }
+
+    bool HierarchicalPathfinder::FindPath(glm::ivec2 start, glm::ivec2 goal, List<glm::ivec2>& outPath) {
+        outPath.SetNum(0, false);
+        pathCost = 0;
+
+        if (!grid->IsWalkable(start.x, start.y) || !grid->IsWalkable(goal.x, goal.y)) {
+            return false;
+        }
+
+        const i32 startClusterIndex = GetClusterIndex(start);
+        const i32 goalClusterIndex = GetClusterIndex(goal);
+        const Cluster& startCluster = clusters[startClusterIndex];
+        const Cluster& goalCluster = clusters[goalClusterIndex];
+
+        // Try staying inside the cluster first, it's the common case for short orders
+        if (startClusterIndex == goalClusterIndex) {
+            if (localSearch.FindPath(*grid, start, goal, startCluster.min, startCluster.max, outPath)) {
+                pathCost = localSearch.GetPathCost();
+                return true;
+            }
+        }
+
+        // Connect the start and goal to the entrances of their clusters
+        const i32 startNodeCount = startCluster.nodes.GetNum();
+        startCosts.SetNum(startNodeCount, false);
+        for (i32 i = 0; i < startNodeCount; i++) {
+            const glm::ivec2 nodePos = nodes[startCluster.nodes[i]].pos;
+            const bool found = localSearch.FindPath(*grid, start, nodePos, startCluster.min, startCluster.max, localPath);
+            startCosts[i] = found ? localSearch.GetPathCost() : UNREACHABLE;
+        }
+
+        const i32 goalNodeCount = goalCluster.nodes.GetNum();
+        goalCosts.SetNum(goalNodeCount, false);
+        for (i32 i = 0; i < goalNodeCount; i++) {
+            const glm::ivec2 nodePos = nodes[goalCluster.nodes[i]].pos;
+            const bool found = localSearch.FindPath(*grid, nodePos, goal, goalCluster.min, goalCluster.max, localPath);
+            goalCosts[i] = found ? localSearch.GetPathCost() : UNREACHABLE;
+        }
+
+        // The start and goal get the two ids past the real nodes
+        const i32 nodeCount = nodes.GetNum();
+        const i32 startId = nodeCount;
+        const i32 goalId = nodeCount + 1;
+
+        searchGeneration++;
+        if (searchNodes.GetNum() != nodeCount + 2 || searchGeneration == 0) {
+            searchNodes.SetNum(nodeCount + 2);
+            for (i32 i = 0; i < nodeCount + 2; i++) {
+                searchNodes[i].generation = 0;
+            }
+            searchGeneration = 1;
+        }
+
+        SearchNode& startNode = searchNodes[startId];
+        startNode.generation = searchGeneration;
+        startNode.g = 0;
+        startNode.parent = -1;
+        startNode.closed = false;
+
+        openList.Clear();
+        openList.Push({ PathOctileDistance(start, goal), 0, startId });
+
+        bool pathFound = false;
+        while (!openList.IsEmpty()) {
+            const PathOpenList::Entry entry = openList.Pop();
+            SearchNode& searchNode = searchNodes[entry.index];
+            if (searchNode.closed || entry.g != searchNode.g) {
+                continue;
+            }
+
+            searchNode.closed = true;
+
+            if (entry.index == goalId) {
+                pathFound = true;
+                break;
+            }
+
+            if (entry.index == startId) {
+                for (i32 i = 0; i < startNodeCount; i++) {
+                    if (startCosts[i] != UNREACHABLE) {
+                        const i32 nodeIndex = startCluster.nodes[i];
+                        Relax(startId, nodeIndex, startCosts[i], nodes[nodeIndex].pos, goal);
+                    }
+                }
+                continue;
+            }
+
+            const Node& node = nodes[entry.index];
+            Relax(entry.index, node.partner, PATH_COST_ORTHOGONAL, nodes[node.partner].pos, goal);
+
+            const Cluster& cluster = clusters[node.cluster];
+            const i32 clusterNodeCount = cluster.nodes.GetNum();
+            for (i32 i = 0; i < clusterNodeCount; i++) {
+                const i32 cost = cluster.costs[node.localIndex * clusterNodeCount + i];
+                if (i != node.localIndex && cost != UNREACHABLE) {
+                    const i32 nodeIndex = cluster.nodes[i];
+                    Relax(entry.index, nodeIndex, cost, nodes[nodeIndex].pos, goal);
+                }
+            }
+
+            if (node.cluster == goalClusterIndex && goalCosts[node.localIndex] != UNREACHABLE) {
+                Relax(entry.index, goalId, goalCosts[node.localIndex], goal, goal);
+            }
+        }
+
+        if (!pathFound) {
+            return false;
+        }
+
+        abstractPath.SetNum(0, false);
+        for (i32 id = goalId; id != -1; id = searchNodes[id].parent) {
+            abstractPath.Add(id);
+        }
+
+        const i32 abstractLength = abstractPath.GetNum();
+        for (i32 i = 0; i < abstractLength / 2; i++) {
+            Swap(abstractPath[i], abstractPath[abstractLength - 1 - i]);
+        }
+
+        // Refine, entrance crossings are a single step and everything else is a search inside one cluster
+        outPath.Add(start);
+        for (i32 i = 0; i + 1 < abstractLength; i++) {
+            const i32 from = abstractPath[i];
+            const i32 to = abstractPath[i + 1];
+            const glm::ivec2 fromPos = from == startId ? start : nodes[from].pos;
+            const glm::ivec2 toPos = to == goalId ? goal : nodes[to].pos;
+
+            if (from != startId && to != goalId && nodes[from].partner == to) {
+                outPath.Add(toPos);
+                continue;
+            }
+
+            const i32 clusterIndex = from == startId ? startClusterIndex : nodes[from].cluster;
+            if (!AppendLocalPath(clusterIndex, fromPos, toPos, outPath)) {
+                outPath.SetNum(0, false);
+                return false;
+            }
+        }
+
+        pathCost = searchNodes[goalId].g;
+
+        return true;
+    }
+
+    i32 HierarchicalPathfinder::GetPathCost() const {
+        return pathCost;
+    }
+
+    i32 HierarchicalPathfinder::GetClusterCount() const {
+        return clusters.GetNum();
+    }
+
+    i32 HierarchicalPathfinder::GetNodeCount() const {
+        return nodes.GetNum() - freeNodes.GetNum();
+    }
+
+    i32 HierarchicalPathfinder::GetClusterIndex(glm::ivec2 tilePos) const {
+        return (tilePos.y / clusterSize) * clustersWide + tilePos.x / clusterSize;
+    }
+
+    i32 HierarchicalPathfinder::GetBorderIndex(i32 clusterA, i32 clusterB) const {
+        // Every cluster owns the border on its right and the one above it
+        Assert(clusterB == clusterA + 1 || clusterB == clusterA + clustersWide, "HierarchicalPathfinder, clusters aren't neighbors");
+        return clusterA * 2 + (clusterB == clusterA + 1 ? 0 : 1);
+    }
+
+    i32 HierarchicalPathfinder::AddNode(glm::ivec2 pos, i32 cluster, i32 border) {
+        i32 nodeIndex = -1;
+        if (freeNodes.GetNum() > 0) {
+            nodeIndex = freeNodes[freeNodes.GetNum() - 1];
+            freeNodes.SetNum(freeNodes.GetNum() - 1, false);
+        }
+        else {
+            nodeIndex = nodes.Add(Node());
+        }
+
+        Node& node = nodes[nodeIndex];
+        node.pos = pos;
+        node.cluster = cluster;
+        node.localIndex = -1;
+        node.border = border;
+        node.partner = -1;
+        node.alive = true;
+
+        clusters[cluster].nodes.Add(nodeIndex);
+
+        return nodeIndex;
+    }
+
+    void HierarchicalPathfinder::BuildBorder(i32 clusterA, i32 clusterB) {
+        const i32 border = GetBorderIndex(clusterA, clusterB);
+        const bool isVertical = clusterB == clusterA + 1;
+        const glm::ivec2 minA = clusters[clusterA].min;
+        const glm::ivec2 maxA = clusters[clusterA].max;
+        const glm::ivec2 step = isVertical ? glm::ivec2(1, 0) : glm::ivec2(0, 1);
+        const i32 length = isVertical ? maxA.y - minA.y + 1 : maxA.x - minA.x + 1;
+
+        // Entrances are runs of border tiles that are open on both sides. Long runs get a transition
+        // at each end so paths along the border don't have to detour through the middle.
+        const i32 longEntranceLength = 6;
+        i32 runStart = -1;
+        for (i32 i = 0; i <= length; i++) {
+            bool isOpen = false;
+            if (i < length) {
+                const glm::ivec2 posA = isVertical ? glm::ivec2(maxA.x, minA.y + i) : glm::ivec2(minA.x + i, maxA.y);
+                const glm::ivec2 posB = posA + step;
+                isOpen = grid->IsWalkable(posA.x, posA.y) && grid->IsWalkable(posB.x, posB.y);
+            }
+
+            if (isOpen && runStart == -1) {
+                runStart = i;
+            }
+            else if (!isOpen && runStart != -1) {
+                const i32 runEnd = i - 1;
+
+                i32 transitions[2] = { (runStart + runEnd) / 2, -1 };
+                if (runEnd - runStart + 1 >= longEntranceLength) {
+                    transitions[0] = runStart;
+                    transitions[1] = runEnd;
+                }
+
+                for (i32 transitionIndex = 0; transitionIndex < 2 && transitions[transitionIndex] != -1; transitionIndex++) {
+                    const i32 offset = transitions[transitionIndex];
+                    const glm::ivec2 posA = isVertical ? glm::ivec2(maxA.x, minA.y + offset) : glm::ivec2(minA.x + offset, maxA.y);
+                    const i32 nodeA = AddNode(posA, clusterA, border);
+                    const i32 nodeB = AddNode(posA + step, clusterB, border);
+                    nodes[nodeA].partner = nodeB;
+                    nodes[nodeB].partner = nodeA;
+                }
+
+                runStart = -1;
+            }
+        }
+    }
+
+    void HierarchicalPathfinder::RemoveBorder(i32 clusterA, i32 clusterB) {
+        const i32 border = GetBorderIndex(clusterA, clusterB);
+        const i32 borderClusters[2] = { clusterA, clusterB };
+        for (i32 i = 0; i < 2; i++) {
+            Cluster& cluster = clusters[borderClusters[i]];
+            for (i32 localIndex = cluster.nodes.GetNum() - 1; localIndex >= 0; localIndex--) {
+                const i32 nodeIndex = cluster.nodes[localIndex];
+                if (nodes[nodeIndex].border == border) {
+                    nodes[nodeIndex].alive = false;
+                    freeNodes.Add(nodeIndex);
+                    cluster.nodes.RemoveIndex(localIndex);
+                }
+            }
+        }
+    }
+
+    void HierarchicalPathfinder::BuildClusterEdges(i32 clusterIndex) {
+        Cluster& cluster = clusters[clusterIndex];
+        const i32 nodeCount = cluster.nodes.GetNum();
+        cluster.costs.SetNum(nodeCount * nodeCount, false);
+
+        for (i32 i = 0; i < nodeCount; i++) {
+            nodes[cluster.nodes[i]].localIndex = i;
+        }
+
+        for (i32 i = 0; i < nodeCount; i++) {
+            cluster.costs[i * nodeCount + i] = 0;
+            for (i32 j = i + 1; j < nodeCount; j++) {
+                const glm::ivec2 from = nodes[cluster.nodes[i]].pos;
+                const glm::ivec2 to = nodes[cluster.nodes[j]].pos;
+                const bool found = localSearch.FindPath(*grid, from, to, cluster.min, cluster.max, localPath);
+                const i32 cost = found ? localSearch.GetPathCost() : UNREACHABLE;
+                cluster.costs[i * nodeCount + j] = cost;
+                cluster.costs[j * nodeCount + i] = cost;
+            }
+        }
+    }
+
+    void HierarchicalPathfinder::Relax(i32 from, i32 to, i32 cost, glm::ivec2 toPos, glm::ivec2 goal) {
+        const i32 g = searchNodes[from].g + cost;
+        SearchNode& node = searchNodes[to];
+        if (node.generation != searchGeneration) {
+            node.generation = searchGeneration;
+            node.closed = false;
+        }
+        else if (node.closed || g >= node.g) {
+            return;
+        }
+
+        node.g = g;
+        node.parent = from;
+        openList.Push({ g + PathOctileDistance(toPos, goal), g, to });
+    }
+
+    bool HierarchicalPathfinder::AppendLocalPath(i32 clusterIndex, glm::ivec2 from, glm::ivec2 to, List<glm::ivec2>& outPath) {
+        const Cluster& cluster = clusters[clusterIndex];
+        if (!localSearch.FindPath(*grid, from, to, cluster.min, cluster.max, localPath)) {
+            return false;
+        }
+
+        // The first tile is already the last one in the path
+        const i32 localLength = localPath.GetNum();
+        for (i32 i = 1; i < localLength; i++) {
+            outPath.Add(localPath[i]);
+        }
+
+        return true;
+    }
+
+    void PathRequestQueue::Clear() {
+        freeRequests.Clear();
+        pendingRequests.Clear();
+        pendingCount = 0;
+
+        // Push in reverse so the lowest slots get handed out first
+        for (i32 requestIndex = CAPCITY - 1; requestIndex >= 0; requestIndex--) {
+            Request& request = requests[requestIndex];
+            request.generation++;
+            request.status = PATH_REQUEST_STATUS_INVALID;
+            request.cancelled = false;
+            request.path.SetNum(0, false);
+            freeRequests.Add(requestIndex);
+        }
+    }
+
+    PathRequestHandle PathRequestQueue::Submit(glm::ivec2 start, glm::ivec2 goal) {
+        PathRequestHandle handle = {};
+        handle.index = -1;
+
+        if (freeRequests.IsEmpty()) {
+            return handle;
+        }
+
+        const i32 freeCount = freeRequests.GetCount();
+        const i32 requestIndex = freeRequests[freeCount - 1];
+        freeRequests.SetCount(freeCount - 1);
+
+        Request& request = requests[requestIndex];
+        request.status = PATH_REQUEST_STATUS_PENDING;
+        request.cancelled = false;
+        request.start = start;
+        request.goal = goal;
+        request.path.SetNum(0, false);
+
+        pendingRequests.Enqueue(requestIndex);
+        pendingCount++;
+
+        handle.index = requestIndex;
+        handle.generation = request.generation;
+
+        return handle;
+    }
+
+    void PathRequestQueue::Release(PathRequestHandle handle) {
+        if (!IsValid(handle)) {
+            return;
+        }
+
+        Request& request = requests[handle.index];
+        request.generation++;
+
+        // Still in the queue, Service frees it when it comes up
+        if (request.status == PATH_REQUEST_STATUS_PENDING) {
+            request.cancelled = true;
+            pendingCount--;
+            return;
+        }
+
+        FreeRequest(handle.index);
+    }
+
+    PathRequestStatus PathRequestQueue::GetStatus(PathRequestHandle handle) const {
+        if (!IsValid(handle)) {
+            return PATH_REQUEST_STATUS_INVALID;
+        }
+
+        return requests[handle.index].status;
+    }
+
+    const List<glm::ivec2>& PathRequestQueue::GetPath(PathRequestHandle handle) const {
+        Assert(GetStatus(handle) == PATH_REQUEST_STATUS_FOUND, "PathRequestQueue, path hasn't been found");
+        return requests[handle.index].path;
+    }
+
+    i32 PathRequestQueue::GetPendingCount() const {
+        return pendingCount;
+    }
+
+    bool PathRequestQueue::IsValid(PathRequestHandle handle) const {
+        return handle.index >= 0 && handle.index < CAPCITY && requests[handle.index].generation == handle.generation &&
+            !requests[handle.index].cancelled;
+    }
+
+    void PathRequestQueue::FreeRequest(i32 requestIndex) {
+        Request& request = requests[requestIndex];
+        request.status = PATH_REQUEST_STATUS_INVALID;
+        request.cancelled = false;
+        freeRequests.Add(requestIndex);
+    }
+}
+
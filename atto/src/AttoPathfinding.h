@@ -0,0 +1,246 @@
+#pragma once
+
+#include "AttoLib.h"
+
+namespace atto
+{
+    static const i32 PATH_COST_ORTHOGONAL = 10;
+    static const i32 PATH_COST_DIAGONAL = 14;
+
+    // One byte per tile. The cells are padded with a blocked border so a search can step to any
+    // neighbor by adding a precomputed offset, without bounds checks.
+    class PathGrid {
+    public:
+        static const i32 DIRECTION_COUNT = 8; // Orthogonal first, then diagonal
+
+        void                    Create(i32 width, i32 height);
+        void                    SetWalkable(i32 x, i32 y, bool walkable);
+        bool                    IsWalkable(i32 x, i32 y) const;
+
+        i32                     GetWidth() const;
+        i32                     GetHeight() const;
+
+        i32                     GetCellCount() const;
+        i32                     GetCellIndex(i32 x, i32 y) const;
+        glm::ivec2              GetCellPos(i32 cellIndex) const;
+        bool                    IsCellWalkable(i32 cellIndex) const;
+
+        // Index of the neighbor in the given direction, or -1 if it can't be stepped to (blocked or cutting a corner)
+        i32                     GetNeighbor(i32 cellIndex, i32 direction) const;
+        static i32              GetDirectionCost(i32 direction);
+        static glm::ivec2       GetDirectionOffset(i32 direction);
+
+    private:
+        i32                     width;
+        i32                     height;
+        i32                     stride;
+        i32                     neighborOffsets[DIRECTION_COUNT];
+        i32                     cornerOffsets[DIRECTION_COUNT][2];
+        List<u8>                cells;
+    };
+
+    // Octile distance, admissible for 8 way movement with diagonal cost 14
+    inline i32 PathOctileDistance(glm::ivec2 a, glm::ivec2 b) {
+        const i32 dx = glm::abs(a.x - b.x);
+        const i32 dy = glm::abs(a.y - b.y);
+        return PATH_COST_ORTHOGONAL * (dx + dy) + (PATH_COST_DIAGONAL - 2 * PATH_COST_ORTHOGONAL) * glm::min(dx, dy);
+    }
+
+    // Binary min heap on f, ties go to the larger g. Searches push duplicates instead of decreasing keys and skip the stale ones
+    class PathOpenList {
+    public:
+        struct Entry {
+            i32                 f;
+            i32                 g;
+            i32                 index;
+        };
+
+        void                    Clear();
+        bool                    IsEmpty() const;
+        void                    Push(const Entry& entry);
+        Entry                   Pop();
+
+    private:
+        static bool             Less(const Entry& a, const Entry& b);
+
+        List<Entry>             heap;
+    };
+
+    // Grid A*. Node state is stamped with the search generation, so nothing is cleared between searches.
+    class AStarSearch {
+    public:
+        // Fills outPath with tile positions from start to goal, both included
+        bool                    FindPath(const PathGrid& grid, glm::ivec2 start, glm::ivec2 goal, List<glm::ivec2>& outPath);
+
+        // Same as above but never leaves the tile rectangle [boundsMin, boundsMax]
+        bool                    FindPath(const PathGrid& grid, glm::ivec2 start, glm::ivec2 goal, glm::ivec2 boundsMin, glm::ivec2 boundsMax, List<glm::ivec2>& outPath);
+
+        i32                     GetPathCost() const;
+        i32                     GetExpandedCount() const;
+
+    private:
+        struct Node {
+            u32                 generation;
+            i32                 g;
+            i32                 parent;
+            bool                closed;
+        };
+
+        u32                     generation;
+        i32                     pathCost;
+        i32                     expandedCount;
+        List<Node>              nodes;
+        PathOpenList            openList;
+    };
+
+    // HPA*. The grid is cut into square clusters, entrances along the cluster borders become nodes of an
+    // abstract graph and the cost between every pair of entrances in a cluster is precomputed. A query
+    // searches the abstract graph and then only refines the clusters along the way with a bounded A*.
+    class HierarchicalPathfinder {
+    public:
+        void                    Build(const PathGrid* grid, i32 clusterSize);
+
+        // Call after changing a tile in the grid, only the tile's cluster and its neighbors are rebuilt
+        void                    UpdateTile(i32 x, i32 y);
+
+        bool                    FindPath(glm::ivec2 start, glm::ivec2 goal, List<glm::ivec2>& outPath);
+
+        i32                     GetPathCost() const;
+        i32                     GetClusterCount() const;
+        i32                     GetNodeCount() const;
+
+    private:
+        struct Node {
+            glm::ivec2          pos;
+            i32                 cluster;
+            i32                 localIndex;     // Into the cluster's nodes
+            i32                 border;
+            i32                 partner;        // The node on the other side of the entrance
+            bool                alive;
+        };
+
+        struct Cluster {
+            glm::ivec2          min;
+            glm::ivec2          max;
+            List<i32>           nodes;
+            List<i32>           costs;          // nodes x nodes, UNREACHABLE when there's no path inside the cluster
+        };
+
+        struct SearchNode {
+            u32                 generation;
+            i32                 g;
+            i32                 parent;
+            bool                closed;
+        };
+
+        static const i32        UNREACHABLE = 0x7FFFFFFF;
+
+        i32                     GetClusterIndex(glm::ivec2 tilePos) const;
+        i32                     GetBorderIndex(i32 clusterA, i32 clusterB) const;
+        i32                     AddNode(glm::ivec2 pos, i32 cluster, i32 border);
+        void                    BuildBorder(i32 clusterA, i32 clusterB);
+        void                    RemoveBorder(i32 clusterA, i32 clusterB);
+        void                    BuildClusterEdges(i32 clusterIndex);
+        void                    Relax(i32 from, i32 to, i32 cost, glm::ivec2 toPos, glm::ivec2 goal);
+        bool                    AppendLocalPath(i32 clusterIndex, glm::ivec2 from, glm::ivec2 to, List<glm::ivec2>& outPath);
+
+        const PathGrid*         grid;
+        i32                     clusterSize;
+        i32                     clustersWide;
+        i32                     clustersHigh;
+        List<Node>              nodes;
+        List<i32>               freeNodes;
+        List<Cluster>           clusters;
+
+        AStarSearch             localSearch;
+        List<glm::ivec2>        localPath;
+
+        u32                     searchGeneration;
+        List<SearchNode>        searchNodes;
+        PathOpenList            openList;
+        List<i32>               startCosts;
+        List<i32>               goalCosts;
+        List<i32>               abstractPath;
+        i32                     pathCost;
+    };
+
+    struct PathRequestHandle {
+        i32                     index;
+        u32                     generation;
+    };
+
+    enum PathRequestStatus {
+        PATH_REQUEST_STATUS_INVALID = 0,    // Never submitted, released, or the handle is stale
+        PATH_REQUEST_STATUS_PENDING,
+        PATH_REQUEST_STATUS_FOUND,
+        PATH_REQUEST_STATUS_FAILED,
+    };
+
+    // Searches are submitted here and run later from Service, as many as fit in a time budget, so a big
+    // order can't stall a frame. Handles are generation stamped like entity ids so released ones stop resolving.
+    class PathRequestQueue {
+    public:
+        static const i32 CAPCITY = 256;
+
+        void                    Clear();
+
+        // Returns a handle with index -1 if the queue is full
+        PathRequestHandle       Submit(glm::ivec2 start, glm::ivec2 goal);
+        void                    Release(PathRequestHandle handle);
+
+        PathRequestStatus       GetStatus(PathRequestHandle handle) const;
+        const List<glm::ivec2>& GetPath(PathRequestHandle handle) const;
+        i32                     GetPendingCount() const;
+
+        // Calls findPath(start, goal, outPath) for pending requests, oldest first, until the budget is spent.
+        // At least one request is always serviced so a budget smaller than a single search can't stall the queue.
+        template<typename _func_>
+        i32                     Service(f64 budgetMicroseconds, _func_ findPath);
+
+    private:
+        struct Request {
+            u32                 generation;
+            PathRequestStatus   status;
+            bool                cancelled;      // Released while pending, freed once it leaves the queue
+            glm::ivec2          start;
+            glm::ivec2          goal;
+            List<glm::ivec2>    path;
+        };
+
+        bool                    IsValid(PathRequestHandle handle) const;
+        void                    FreeRequest(i32 requestIndex);
+
+        Request                         requests[CAPCITY];
+        FixedList<i32, CAPCITY>         freeRequests;
+        FixedQueue<i32, CAPCITY>        pendingRequests;
+        i32                             pendingCount;
+    };
+
+    template<typename _func_>
+    i32 PathRequestQueue::Service(f64 budgetMicroseconds, _func_ findPath) {
+        Clock clock;
+        clock.Start();
+
+        i32 servicedCount = 0;
+        while (!pendingRequests.IsEmpty()) {
+            const i32 requestIndex = pendingRequests.Dequeue();
+            Request& request = requests[requestIndex];
+            if (request.cancelled) {
+                FreeRequest(requestIndex);
+                continue;
+            }
+
+            const bool found = findPath(request.start, request.goal, request.path);
+            request.status = found ? PATH_REQUEST_STATUS_FOUND : PATH_REQUEST_STATUS_FAILED;
+            pendingCount--;
+            servicedCount++;
+
+            clock.End();
+            if (clock.GetElapsedMicroseconds() >= budgetMicroseconds) {
+                break;
+            }
+        }
+
+        return servicedCount;
+    }
+}
@@ -149,57 +149,293 @@ namespace atto
         std::memcpy(tile.data.GetData(), temp.GetData(), size);
     }
 
+    void SkylinePacker::Begin(i32 width, i32 height) {
+        this->width = width;
+        this->height = height;
+
+        skyline.SetNum(0, false);
+        Node node = {};
+        node.width = width;
+        skyline.Add(node);
+    }
+
+    bool SkylinePacker::Fits(i32 nodeIndex, i32 width, i32 height, i32& outY) const {
+        const i32 x = skyline[nodeIndex].x;
+        if (x + width > this->width) {
+            return false;
+        }
+
+        // The rect rests on the highest node it spans
+        i32 y = 0;
+        i32 widthLeft = width;
+        for (i32 i = nodeIndex; widthLeft > 0; i++) {
+            y = glm::max(y, skyline[i].y);
+            if (y + height > this->height) {
+                return false;
+            }
+
+            widthLeft -= skyline[i].width;
+        }
+
+        outY = y;
+
+        return true;
+    }
+
+    bool SkylinePacker::Pack(i32 width, i32 height, i32& outX, i32& outY) {
+        i32 bestIndex = -1;
+        i32 bestTop = this->height + 1;
+        i32 bestWidth = this->width + 1;
+        i32 bestY = 0;
+
+        const i32 nodeCount = skyline.GetNum();
+        for (i32 nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++) {
+            i32 y = 0;
+            if (Fits(nodeIndex, width, height, y)) {
+                const i32 top = y + height;
+                if (top < bestTop || (top == bestTop && skyline[nodeIndex].width < bestWidth)) {
+                    bestIndex = nodeIndex;
+                    bestTop = top;
+                    bestWidth = skyline[nodeIndex].width;
+                    bestY = y;
+                }
+            }
+        }
+
+        if (bestIndex == -1) {
+            return false;
+        }
+
+        Node node = {};
+        node.x = skyline[bestIndex].x;
+        node.y = bestY + height;
+        node.width = width;
+        skyline.Insert(node, bestIndex);
+
+        // Cut the nodes the new one now covers
+        for (i32 i = bestIndex + 1; i < skyline.GetNum();) {
+            const Node& previous = skyline[i - 1];
+            Node& current = skyline[i];
+            const i32 overlap = previous.x + previous.width - current.x;
+            if (overlap <= 0) {
+                break;
+            }
+
+            current.x += overlap;
+            current.width -= overlap;
+            if (current.width > 0) {
+                break;
+            }
+
+            skyline.RemoveIndex(i);
+        }
+
+        // Neighbors at the same height become one node
+        for (i32 i = 0; i < skyline.GetNum() - 1;) {
+            if (skyline[i].y == skyline[i + 1].y) {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.RemoveIndex(i + 1);
+            }
+            else {
+                i++;
+            }
+        }
+
+        outX = node.x;
+        outY = bestY;
+
+        return true;
+    }
+
+    void TextureAtlasBuilder::Begin(i32 pageSize, i32 padding) {
+        this->pageSize = pageSize;
+        this->padding = padding;
+        pages.Clear();
+        regions.Clear();
+        images.Clear();
+        packers.Clear();
+    }
+
+    i32 TextureAtlasBuilder::Add(const byte* pixels, i32 width, i32 height) {
+        Image& image = images.Alloc();
+        image.width = width;
+        image.height = height;
+        image.pixels.SetNum(width * height * 4);
+        std::memcpy(image.pixels.GetData(), pixels, width * height * 4);
+
+        Region& region = regions.Alloc();
+        region = {};
+        region.page = -1;
+        region.width = width;
+        region.height = height;
+
+        return regions.GetNum() - 1;
+    }
+
+    void TextureAtlasBuilder::Build() {
+        const i32 imageCount = images.GetNum();
+
+        // Tallest first, then widest, keeps the skyline flat
+        List<u64> keys;
+        List<i32> order;
+        List<u64> scratchKeys;
+        List<i32> scratchOrder;
+        keys.SetNum(imageCount);
+        order.SetNum(imageCount);
+        scratchKeys.SetNum(imageCount);
+        scratchOrder.SetNum(imageCount);
+        for (i32 imageIndex = 0; imageIndex < imageCount; imageIndex++) {
+            const u64 height = (u64)(0xFFFF - glm::min(images[imageIndex].height, 0xFFFF));
+            const u64 width = (u64)(0xFFFF - glm::min(images[imageIndex].width, 0xFFFF));
+            keys[imageIndex] = (height << 16) | width;
+            order[imageIndex] = imageIndex;
+        }
+
+        Sorting::RadixSort64(keys.GetData(), order.GetData(), scratchKeys.GetData(), scratchOrder.GetData(), imageCount);
+
+        for (i32 orderIndex = 0; orderIndex < imageCount; orderIndex++) {
+            const i32 imageIndex = order[orderIndex];
+            const Image& image = images[imageIndex];
+            Region& region = regions[imageIndex];
+
+            const i32 paddedWidth = image.width + padding * 2;
+            const i32 paddedHeight = image.height + padding * 2;
+            if (paddedWidth > pageSize || paddedHeight > pageSize) {
+                ATTOWARN("Atlas image of %dx%d is too big for a page", image.width, image.height);
+                continue;
+            }
+
+            i32 x = 0;
+            i32 y = 0;
+            i32 pageIndex = 0;
+            for (; pageIndex < packers.GetNum(); pageIndex++) {
+                if (packers[pageIndex].Pack(paddedWidth, paddedHeight, x, y)) {
+                    break;
+                }
+            }
+
+            if (pageIndex == packers.GetNum()) {
+                SkylinePacker& packer = packers.Alloc();
+                packer.Begin(pageSize, pageSize);
+                packer.Pack(paddedWidth, paddedHeight, x, y);
+
+                Page& page = pages.Alloc();
+                page.width = pageSize;
+                page.height = pageSize;
+                page.pixels.SetNum(pageSize * pageSize * 4);
+                std::memset(page.pixels.GetData(), 0, pageSize * pageSize * 4);
+            }
+
+            region.page = pageIndex;
+            region.x = x + padding;
+            region.y = y + padding;
+
+            Blit(image, region);
+        }
+
+        images.Clear();
+    }
+
+    void TextureAtlasBuilder::Blit(const Image& image, const Region& region) {
+        Page& page = pages[region.page];
+        const u32* src = (const u32*)image.pixels.GetData();
+        u32* dst = (u32*)page.pixels.GetData();
+
+        // Every padding pixel takes the nearest edge pixel of the image
+        for (i32 y = -padding; y < image.height + padding; y++) {
+            const i32 srcY = glm::clamp(y, 0, image.height - 1);
+            u32* dstRow = dst + (region.y + y) * page.width + region.x;
+            const u32* srcRow = src + srcY * image.width;
+            for (i32 x = -padding; x < image.width + padding; x++) {
+                dstRow[x] = srcRow[glm::clamp(x, 0, image.width - 1)];
+            }
+        }
+    }
+
     void LeEngine::InitializeShapeRendering() {
         const char* vertexShaderSource = R"(
-            #version 330 core
-
             layout (location = 0) in vec2 position;
+            layout (location = 1) in vec4 color;
 
-            uniform mat4 p;
+            out vec4 vertexColor;
 
             void main() {
-                gl_Position = p * vec4(position.x, position.y, 0.0, 1.0);
+                vertexColor = color;
+                gl_Position = screenProjection * vec4(position.x, position.y, 0.0, 1.0);
             }
         )";
 
         const char* fragmentShaderSource = R"(
-            #version 330 core
             out vec4 FragColor;
 
-            uniform int  mode;
-            uniform vec4 color;
-            uniform vec4 shapePosAndSize;
-            uniform vec4 shapeRadius;
+            in vec4 vertexColor;
 
-            // from http://www.iquilezles.org/www/articles/distfunctions/distfunctions
+            void main() {
+                FragColor = vertexColor;
+            }
+        )";
+
+        const char* instancedVertexShaderSource = R"(
+            layout (location = 0) in vec4 shapeCenterAndHalfSize;
+            layout (location = 1) in vec3 shapeRotationRadiusType;
+            layout (location = 2) in vec4 color;
+
+            out vec2 localPos;
+            flat out vec2 halfSize;
+            flat out float radius;
+            flat out int type;
+            flat out vec4 shapeColor;
 
-            float CircleSDF(vec2 r, vec2 p, float rad) {
-                return 1 - max(length(p - r) - rad, 0);
+            const vec2 corners[6] = vec2[6](
+                vec2(-1, 1), vec2(-1, -1), vec2(1, -1),
+                vec2(-1, 1), vec2(1, -1), vec2(1, 1)
+            );
+
+            void main() {
+                halfSize = shapeCenterAndHalfSize.zw;
+                radius = shapeRotationRadiusType.y;
+                type = int(shapeRotationRadiusType.z);
+                shapeColor = color;
+                localPos = corners[gl_VertexID] * halfSize;
+
+                float c = cos(shapeRotationRadiusType.x);
+                float s = sin(shapeRotationRadiusType.x);
+                vec2 position = shapeCenterAndHalfSize.xy + vec2(c * localPos.x + s * localPos.y, -s * localPos.x + c * localPos.y);
+                gl_Position = screenProjection * vec4(position.x, position.y, 0.0, 1.0);
             }
+        )";
 
-            float BoxSDF(vec2 r, vec2 p, vec2 s) {
-                return 1 - length(max(abs(p - r) - s, 0));
+        const char* instancedFragmentShaderSource = R"(
+            out vec4 FragColor;
+
+            in vec2 localPos;
+            flat in vec2 halfSize;
+            flat in float radius;
+            flat in int type;
+            flat in vec4 shapeColor;
+
+            // from http://www.iquilezles.org/www/articles/distfunctions/distfunctions
+            // Evaluated around the shape's center, in pixels
+
+            float CircleSDF(vec2 p, float rad) {
+                return 1 - max(length(p) - rad, 0);
             }
-            
-            float RoundedBoxSDF(vec2 r, vec2 p, vec2 s, float rad) {
-                return 1 - (length(max(abs(p - r) - s + rad, 0)) - rad);
+
+            float RoundedBoxSDF(vec2 p, vec2 s, float rad) {
+                return 1 - (length(max(abs(p) - s + rad, 0)) - rad);
             }
 
             void main() {
-                vec2 s = shapePosAndSize.zw;
-                vec2 r = shapePosAndSize.xy;
-                vec2 p = gl_FragCoord.xy;
-
-                if (mode == 0) {
-                    FragColor = color;
-                } else if (mode == 1) {
-                    float d = CircleSDF(r, p, shapeRadius.x);
+                if (type == 0) {
+                    FragColor = shapeColor;
+                } else if (type == 1) {
+                    float d = CircleSDF(localPos, radius);
                     d = clamp(d, 0.0, 1.0);
-                    FragColor = color * d; //vec4(color.xyz, color.w * d);
-                } else if (mode == 2) {
-                    float d = RoundedBoxSDF(r, p, s / 2, shapeRadius.x);
+                    FragColor = shapeColor * d;
+                } else if (type == 2) {
+                    float d = RoundedBoxSDF(localPos, halfSize, radius);
                     d = clamp(d, 0.0, 1.0);
-                    FragColor = vec4(color.xyz, color.w * d);
+                    FragColor = vec4(shapeColor.xyz, shapeColor.w * d);
                 } else {
                     FragColor = vec4(1, 0, 1, 1);
                 }
@@ -207,33 +443,34 @@ namespace atto
         )";
 
         shapeRenderingState.program = SubmitShaderProgram(vertexShaderSource, fragmentShaderSource);
-        shapeRenderingState.vertexBuffer = SubmitVertexBuffer(sizeof(ShapeVertex) * 32, nullptr, VERTEX_LAYOUT_TYPE_SHAPE, true);
+        shapeRenderingState.instancedProgram = SubmitShaderProgram(instancedVertexShaderSource, instancedFragmentShaderSource);
+        shapeRenderingState.vertexBuffer = SubmitStreamingVertexBuffer(VERTEX_LAYOUT_TYPE_SHAPE);
+        shapeRenderingState.instanceBuffer = SubmitStreamingVertexBuffer(VERTEX_LAYOUT_TYPE_SHAPE_INSTANCE);
 
         ATTOTRACE("Completed shape rendering initialization");
     }
 
     void LeEngine::InitializeSpriteRendering() {
         const char* vertexShaderSource = R"(
-            #version 330 core
-
-            layout (location = 0) in vec2 position;
+            layout (location = 0) in vec2 position;     // Fixed point, relative to batchOrigin
             layout (location = 1) in vec2 texCoord;
             layout (location = 2) in vec4 color;
 
             out vec2 vertexTexCoord;
             out vec4 vertexColor;
 
-            uniform mat4 p;
+            uniform vec2 batchOrigin;
+            uniform float positionScale;                // 1 / SpriteVertex::POSITION_SCALE
 
             void main() {
+                vec2 worldPosition = batchOrigin + position * positionScale;
                 vertexTexCoord = texCoord;
                 vertexColor = color;
-                gl_Position = p * vec4(position.x, position.y, 0.0, 1.0);
+                gl_Position = cameraViewProjection * vec4(worldPosition.x, worldPosition.y, 0.0, 1.0);
             }
         )";
 
         const char* fragmentShaderSource = R"(
-            #version 330 core
             out vec4 FragColor;
 
             in vec2 vertexTexCoord;
@@ -316,9 +553,50 @@ namespace atto
             }
         )";
 
+        // Builds the same quad, uvs and winding as the CPU path in DrawSpriteBuildVertices
+        const char* instancedVertexShaderSource = R"(
+            layout (location = 0) in vec3 transform;    // Position, rotation
+            layout (location = 1) in vec4 frame;        // Size, origin offset
+            layout (location = 2) in vec4 uvRect;       // uv0 and uv1 of the frame
+            layout (location = 3) in vec4 color;
+
+            out vec2 vertexTexCoord;
+            out vec4 vertexColor;
+
+            const vec2 corners[6] = vec2[6](
+                vec2(0, 1), vec2(0, 0), vec2(1, 0),
+                vec2(0, 1), vec2(1, 0), vec2(1, 1)
+            );
+
+            void main() {
+                vec2 corner = corners[gl_VertexID];
+                vec2 local = frame.zw + corner * frame.xy;
+
+                float c = cos(transform.z);
+                float s = sin(transform.z);
+                vec2 position = transform.xy + vec2(c * local.x + s * local.y, -s * local.x + c * local.y);
+
+                vertexTexCoord = vec2(mix(uvRect.x, uvRect.z, corner.x), mix(uvRect.w, uvRect.y, corner.y));
+                vertexColor = color;
+                gl_Position = cameraViewProjection * vec4(position.x, position.y, 0.0, 1.0);
+            }
+        )";
+
+        spriteRenderingState.mode = SPRITE_RENDER_MODE_BATCHED;
         spriteRenderingState.color = glm::vec4(1, 1, 1, 1);
         spriteRenderingState.program = SubmitShaderProgram(vertexShaderSource, fragmentShaderSource);
-        spriteRenderingState.vertexBuffer = SubmitVertexBuffer(sizeof(SpriteVertex) * 6, nullptr, VERTEX_LAYOUT_TYPE_SPRITE, true);
+        spriteRenderingState.instancedProgram = SubmitShaderProgram(instancedVertexShaderSource, fragmentShaderSource);
+
+        // Everything draws from texture unit 0, so the samplers only need setting once, as does the fixed point scale
+        ShaderProgramBind(&spriteRenderingState.program);
+        ShaderProgramSetSampler(ShaderProgramGetUniform(&spriteRenderingState.program, "texture0"), 0);
+        spriteRenderingState.batchOriginUniform = ShaderProgramGetUniform(&spriteRenderingState.program, "batchOrigin");
+        ShaderProgramSetFloat(ShaderProgramGetUniform(&spriteRenderingState.program, "positionScale"), 1.0f / SpriteVertex::POSITION_SCALE);
+        ShaderProgramBind(&spriteRenderingState.instancedProgram);
+        ShaderProgramSetSampler(ShaderProgramGetUniform(&spriteRenderingState.instancedProgram, "texture0"), 0);
+
+        spriteRenderingState.vertexBuffer = SubmitStreamingVertexBuffer(VERTEX_LAYOUT_TYPE_SPRITE);
+        spriteRenderingState.instanceBuffer = SubmitStreamingVertexBuffer(VERTEX_LAYOUT_TYPE_SPRITE_INSTANCE);
 
         ATTOTRACE("Completed sprite rendering initialization");
     }
@@ -328,23 +606,18 @@ namespace atto
         textRenderingState.underlinePercent = 1.0f;
 
         const char* vertexShaderSource = R"(
-            #version 330 core
-
             layout (location = 0) in vec2 position;
             layout (location = 1) in vec2 texCoord;
 
             out vec2 vertexTexCoord;
 
-            uniform mat4 p;
-
             void main() {
                 vertexTexCoord = texCoord;
-                gl_Position = p * vec4(position.x, position.y, 0.0, 1.0);
+                gl_Position = screenProjection * vec4(position.x, position.y, 0.0, 1.0);
             }
         )";
 
         const char* fragmentShaderSource = R"(
-            #version 330 core
             out vec4 FragColor;
 
             in vec2 vertexTexCoord;
@@ -364,7 +637,30 @@ namespace atto
         )";
 
         textRenderingState.program = SubmitShaderProgram(vertexShaderSource, fragmentShaderSource);
-        textRenderingState.vertexBuffer = SubmitVertexBuffer(sizeof(FontVertex) * 6, nullptr, VERTEX_LAYOUT_TYPE_FONT, true);
+        textRenderingState.modeUniform = ShaderProgramGetUniform(&textRenderingState.program, "mode");
+        textRenderingState.colorUniform = ShaderProgramGetUniform(&textRenderingState.program, "color");
+
+        ShaderProgramBind(&textRenderingState.program);
+        ShaderProgramSetSampler(ShaderProgramGetUniform(&textRenderingState.program, "texture0"), 0);
+
+        textRenderingState.vertexBuffer = SubmitStreamingVertexBuffer(VERTEX_LAYOUT_TYPE_FONT);
+
+        TextLayoutCache& layoutCache = textRenderingState.layoutCache;
+        layoutCache.entryCount = 0;
+        layoutCache.lruHead = -1;
+        layoutCache.lruTail = -1;
+        for (i32 bucket = 0; bucket < TextLayoutCache::BUCKET_COUNT; bucket++) {
+            layoutCache.buckets[bucket] = -1;
+            layoutCache.missedHashes[bucket] = 0;
+        }
+        layoutCache.entries.SetNum(TextLayoutCache::ENTRY_CAPCITY);
+        layoutCache.vertices.SetNum(TextLayoutCache::ENTRY_CAPCITY * TextLayoutCache::MAX_GLYPHS * 6);
+
+        // The labels never change, format them once
+        textRenderingState.tileIndexLabels.SetNum(Map::TILE_CAPCITY);
+        for (i32 tileIndex = 0; tileIndex < Map::TILE_CAPCITY; tileIndex++) {
+            textRenderingState.tileIndexLabels[tileIndex] = StringFormat::Small("%d", tileIndex);
+        }
         textRenderingState.font = LoadFontAsset(FontAssetId::Create("assets/fonts/arial"));
         
         ATTOTRACE("Completed text rendering initialization");
@@ -374,23 +670,18 @@ namespace atto
         debugRenderingState.color = glm::vec4(0, 1, 0, 1);
 
         const char* vertexShaderSource = R"(
-            #version 330 core
-
             layout (location = 0) in vec2 position;
             layout (location = 1) in vec4 color;
 
             out vec4 vertexColor;
 
-            uniform mat4 p;
-
             void main() {
-                gl_Position = p * vec4(position.x, position.y, 0.0, 1.0);
+                gl_Position = cameraViewProjection * vec4(position.x, position.y, 0.0, 1.0);
                 vertexColor = color;
             }
         )";
 
         const char* fragmentShaderSource = R"(
-            #version 330 core
             out vec4 FragColor;
 
             in vec4 vertexColor;
@@ -402,10 +693,7 @@ namespace atto
 
         debugRenderingState.program = SubmitShaderProgram(vertexShaderSource, fragmentShaderSource);
 
-        debugRenderingState.vertexBufer = SubmitVertexBuffer(
-            debugRenderingState.lines.GetCapcity() * sizeof(DebugLineVertex), nullptr,
-            VERTEX_LAYOUT_TYPE_DEBUG_LINE, true
-        );
+        debugRenderingState.vertexBufer = SubmitStreamingVertexBuffer(VERTEX_LAYOUT_TYPE_DEBUG_LINE);
 
         ATTOTRACE("Completed debug rendering initialization");
     }
@@ -59,6 +59,70 @@ namespace atto
     private:
         void            FlipTile(Tile& tile);
     };
+
+    // Bottom left skyline packer. The skyline is the top edge of everything packed so far, a rect goes where
+    // its top ends up lowest, ties go to the narrowest segment.
+    class SkylinePacker {
+    public:
+        void            Begin(i32 width, i32 height);
+        bool            Pack(i32 width, i32 height, i32& outX, i32& outY);
+
+    private:
+        struct Node {
+            i32         x;
+            i32         y;
+            i32         width;
+        };
+
+        bool            Fits(i32 nodeIndex, i32 width, i32 height, i32& outY) const;
+
+        i32             width;
+        i32             height;
+        List<Node>      skyline;
+    };
+
+    // Packs RGBA8 images into fixed size atlas pages. Each image gets a border of padding pixels filled by
+    // extruding its edges, so filtering at the edges never picks up a neighbor. Nothing here touches GL.
+    class TextureAtlasBuilder {
+    public:
+        struct Page {
+            i32         width;
+            i32         height;
+            List<byte>  pixels;
+        };
+
+        // Where the image ended up, without the padding. Page is -1 if it doesn't fit on a page
+        struct Region {
+            i32         page;
+            i32         x;
+            i32         y;
+            i32         width;
+            i32         height;
+        };
+
+        void            Begin(i32 pageSize, i32 padding);
+        // Copies the pixels, returns the index of the image's region
+        i32             Add(const byte* pixels, i32 width, i32 height);
+        // Packs the tallest images first, each goes on the first page with room for it
+        void            Build();
+
+        List<Page>      pages;
+        List<Region>    regions;
+
+    private:
+        struct Image {
+            i32         width;
+            i32         height;
+            List<byte>  pixels;
+        };
+
+        void            Blit(const Image& image, const Region& region);
+
+        i32                     pageSize;
+        i32                     padding;
+        List<Image>             images;
+        List<SkylinePacker>     packers;
+    };
     
 }
 